@@ -53,6 +53,7 @@ int main(int argc, char **argv) {
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
 	glutInitWindowSize(800, 600);
 	glutCreateWindow("test");
+	mtexp_init();
 	
 	glutDisplayFunc(update_display);
 	glutIdleFunc(update_display);
@@ -0,0 +1,386 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdlib.h>
+#include "bake.h"
+#include "optimize.h"
+#include "program.h"
+
+#define IS_OP(t)		((t)->symb.type == SYMB_TYPE_OP)
+#define IS_SHARED(t)	(IS_OP(t) && (t)->left == (t)->right)
+#define IS_TEX(t)		((t)->symb.symb >= SYMB_T0)
+#define SLOT(t)			((t)->symb.symb - SYMB_T0)
+
+/* slots the bit masks can tell apart, the rest are always dynamic */
+#define MASK_SLOTS		32
+
+/* images of the static textures, read back for baking */
+struct image {
+	unsigned char *pixels;
+	int width, height;
+};
+
+struct search {
+	unsigned int dynamic;
+	struct ptree **best;
+	int best_size;
+};
+
+static void group_static(struct ptree *t, unsigned int dynamic);
+static void flatten(struct ptree *t, int op, struct ptree **opnd, int *nopnd, struct ptree **node, int *nnode);
+static int is_static(const struct ptree *t, unsigned int dynamic);
+static int find_static(struct ptree **link, struct search *s);
+static void consider(struct ptree **link, int size, struct search *s);
+static void eval_texel(const struct program *prog, const struct image *img, float u, float v, float (*res)[4]);
+static void eval_instr(const struct instr *in, float (*src)[4], float *res);
+
+static struct bake *bakes;
+
+/* --- mtexp_find_static() ---
+ * A subtree is static if all of its leaves are. The largest subtrees
+ * that are static are the operands of the dynamic operators, and the one
+ * with the most nodes gets baked. The static operands of chains of + and
+ * * are grouped together first, wherever reassociation put them.
+ */
+struct ptree **mtexp_find_static(struct ptree **root, unsigned int dynamic) {
+	struct search s;
+	int size;
+
+	group_static(*root, dynamic);
+
+	s.dynamic = dynamic;
+	s.best = 0;
+	s.best_size = 0;
+
+	if((size = find_static(root, &s))) {
+		consider(root, size, &s);
+	}
+	return s.best;
+}
+
+/* --- mtexp_bake() ---
+ * The static textures are sampled at the centers of the texels of the
+ * largest one (nearest), assuming they share their texture coordinates,
+ * and combined by the instructions the units would run. The alpha is the
+ * product of the texture alphas, as left by the default alpha combiners.
+ */
+int mtexp_bake(struct bake *bake) {
+	struct image img[MASK_SLOTS];
+	unsigned char *pixels = 0, *dest;
+	float (*col)[4];
+	int i, x, y, width = 0, height = 0, res = -1;
+
+	/* results of every instruction, the last one is the texel */
+	if(!(col = malloc(bake->prog->count * sizeof *col))) {
+		return -1;
+	}
+
+	for(i=0; i<MASK_SLOTS; i++) {
+		img[i].pixels = 0;
+	}
+
+	for(i=0; i<MASK_SLOTS; i++) {
+		if(!(bake->slots & (1u << i))) continue;
+
+		if(!(img[i].pixels = gls_read_texture(bake->state->tex[i], &img[i].width, &img[i].height))) {
+			break;
+		}
+		if(img[i].width > width) width = img[i].width;
+		if(img[i].height > height) height = img[i].height;
+	}
+
+	if(i == MASK_SLOTS && width > 0 && (pixels = malloc(width * height * 4))) {
+		dest = pixels;
+		for(y=0; y<height; y++) {
+			for(x=0; x<width; x++) {
+				eval_texel(bake->prog, img, (x + 0.5f) / width, (y + 0.5f) / height, col);
+
+				for(i=0; i<4; i++) {
+					*dest++ = (unsigned char)(col[bake->prog->count - 1][i] * 255.0f + 0.5f);
+				}
+			}
+		}
+		gls_upload_texture(&bake->tex, width, height, pixels);
+		bake->stale = 0;
+		res = 0;
+	}
+
+	free(pixels);
+	free(col);
+	for(i=0; i<MASK_SLOTS; i++) {
+		free(img[i].pixels);
+	}
+	return res;
+}
+
+unsigned int mtexp_tree_slots(const struct ptree *t) {
+	if(!IS_OP(t)) {
+		return IS_TEX(t) && SLOT(t) < MASK_SLOTS ? 1u << SLOT(t) : 0;
+	}
+	return mtexp_tree_slots(t->left) | mtexp_tree_slots(t->right);
+}
+
+void mtexp_bake_add(struct bake *bake) {
+	bake->next = bakes;
+	bakes = bake;
+}
+
+void mtexp_bake_remove(struct bake *bake) {
+	struct bake **link = &bakes;
+
+	while(*link && *link != bake) {
+		link = &(*link)->next;
+	}
+	if(*link) *link = bake->next;
+
+	if(bake->tex) gls_delete_texture(bake->tex);
+}
+
+/* ---- public interface ---- */
+
+void mtexp_texture_changed(unsigned int tex) {
+	struct bake *b;
+	int i;
+
+	for(b=bakes; b; b=b->next) {
+		for(i=0; i<MASK_SLOTS; i++) {
+			if((b->slots & (1u << i)) && b->state->tex[i] == tex) {
+				b->stale = 1;
+			}
+		}
+	}
+}
+
+/* ---------- local functions ----------- */
+
+/* --- group_static() ---
+ * rebuilds chains of + and * as left-deep chains with the static
+ * operands first, reusing the operator nodes. Chains with scale factors
+ * are left alone, they only scale the operand they're grouped with.
+ */
+static void group_static(struct ptree *t, unsigned int dynamic) {
+	struct ptree *opnd[STACK_SIZE], *node[STACK_SIZE], *sorted[STACK_SIZE], *chain;
+	int i, n, op, nopnd = 0, nnode = 0;
+
+	if(!IS_OP(t)) return;
+
+	op = t->symb.symb;
+	if(IS_SHARED(t) || (op != SYMB_PLUS && op != SYMB_MUL)) {
+		group_static(t->left, dynamic);
+		if(!IS_SHARED(t)) group_static(t->right, dynamic);
+		return;
+	}
+
+	flatten(t, op, opnd, &nopnd, node, &nnode);
+	for(i=0; i<nopnd; i++) {
+		group_static(opnd[i], dynamic);
+		if(mtexp_scale_factor(opnd[i])) return;
+	}
+
+	n = 0;
+	for(i=0; i<nopnd; i++) {
+		if(is_static(opnd[i], dynamic)) sorted[n++] = opnd[i];
+	}
+	for(i=0; i<nopnd; i++) {
+		if(!is_static(opnd[i], dynamic)) sorted[n++] = opnd[i];
+	}
+
+	/* the root of the chain stays at the top */
+	chain = sorted[0];
+	for(i=1; i<nopnd; i++) {
+		node[nopnd - 1 - i]->left = chain;
+		node[nopnd - 1 - i]->right = sorted[i];
+		chain = node[nopnd - 1 - i];
+	}
+}
+
+static void flatten(struct ptree *t, int op, struct ptree **opnd, int *nopnd, struct ptree **node, int *nnode) {
+	if(IS_OP(t) && !IS_SHARED(t) && t->symb.symb == op) {
+		node[(*nnode)++] = t;
+		flatten(t->left, op, opnd, nopnd, node, nnode);
+		flatten(t->right, op, opnd, nopnd, node, nnode);
+	} else {
+		opnd[(*nopnd)++] = t;
+	}
+}
+
+static int is_static(const struct ptree *t, unsigned int dynamic) {
+	int slot;
+
+	if(IS_OP(t)) {
+		return is_static(t->left, dynamic) && is_static(t->right, dynamic);
+	}
+	if(t->symb.symb == SYMB_COL) return 0;
+	if(IS_TEX(t)) {
+		slot = SLOT(t);
+		return slot < MASK_SLOTS && !(dynamic & (1u << slot));
+	}
+	return 1;
+}
+
+/* returns the size of the subtree if it's static, otherwise 0 */
+static int find_static(struct ptree **link, struct search *s) {
+	struct ptree *t = *link;
+	int lsize, rsize;
+
+	if(!IS_OP(t)) {
+		return is_static(t, s->dynamic);
+	}
+
+	lsize = find_static(&t->left, s);
+	rsize = IS_SHARED(t) ? lsize : find_static(&t->right, s);
+
+	if(lsize && rsize) {
+		return lsize + rsize + 1;
+	}
+
+	/* the static operands of a dynamic operator are as large as they get */
+	consider(&t->left, lsize, s);
+	if(!IS_SHARED(t)) consider(&t->right, rsize, s);
+	return 0;
+}
+
+/* only operators are worth baking, a single texture is read as it is */
+static void consider(struct ptree **link, int size, struct search *s) {
+	if(IS_OP(*link) && size > s->best_size) {
+		s->best = link;
+		s->best_size = size;
+	}
+}
+
+/* --- eval_texel() ---
+ * runs the program on a texel, leaving the result of every instruction
+ * in res. Operands which aren't textures have an alpha of 1, and each
+ * instruction multiplies the alphas of its different operands.
+ */
+static void eval_texel(const struct program *prog, const struct image *img, float u, float v, float (*res)[4]) {
+	static const float one[] = {1.0f, 1.0f, 1.0f, 1.0f};
+	float src[MAX_SOURCES][4];
+	int i, j, k, x, y;
+
+	for(i=0; i<prog->count; i++) {
+		const struct instr *in = prog->code + i;
+		float alpha = 1.0f;
+
+		for(j=0; j<MAX_SOURCES; j++) {
+			const float *val;
+
+			switch(in->src[j]) {
+			case SRC_PREV:
+				val = res[in->arg[j]];
+				break;
+
+			case SRC_TEX:
+				{
+					const struct image *im = img + in->arg[j];
+					const unsigned char *texel;
+
+					x = (int)(u * im->width);
+					y = (int)(v * im->height);
+					texel = im->pixels + (y * im->width + x) * 4;
+
+					for(k=0; k<4; k++) {
+						src[j][k] = texel[k] / 255.0f;
+					}
+					val = src[j];
+				}
+				break;
+
+			case SRC_CONST:
+				val = prog->consts[in->arg[j]];
+				break;
+
+			default:
+				/* static subtrees never read the primary color */
+				val = one;
+				break;
+			}
+			for(k=0; k<3; k++) {
+				src[j][k] = val[k];
+			}
+			src[j][3] = in->src[j] == SRC_CONST ? 1.0f : val[3];
+
+			/* unused sources are copies of the first one */
+			for(k=0; k<j; k++) {
+				if(in->src[k] == in->src[j] && in->arg[k] == in->arg[j]) break;
+			}
+			if(k == j) alpha *= src[j][3];
+		}
+
+		eval_instr(in, src, res[i]);
+		res[i][3] = alpha;
+	}
+}
+
+/* computes the color of an instruction like its combiner, saturating
+ * once after the scale.
+ */
+static void eval_instr(const struct instr *in, float (*src)[4], float *res) {
+	float *a = src[0], *b = src[1], *c = src[2];
+	float dot;
+	int i;
+
+	for(i=0; i<3; i++) {
+		switch(in->op) {
+		case OP_ADD:
+			res[i] = a[i] + b[i];
+			break;
+
+		case OP_SUB:
+			res[i] = a[i] - b[i];
+			break;
+
+		case OP_MUL:
+			res[i] = a[i] * b[i];
+			break;
+
+		case OP_DOT:
+			dot = (a[0] - 0.5f) * (b[0] - 0.5f) + (a[1] - 0.5f) * (b[1] - 0.5f) +
+				(a[2] - 0.5f) * (b[2] - 0.5f);
+			res[i] = 4.0f * dot;
+			break;
+
+		case OP_INTERPOLATE:
+			res[i] = a[i] * c[i] + b[i] * (1.0f - c[i]);
+			break;
+
+		case OP_ADD_SIGNED:
+			res[i] = a[i] + b[i] - 0.5f;
+			break;
+
+		case OP_MODULATE_ADD:
+			res[i] = a[i] * b[i] + c[i];
+			break;
+
+		case OP_MODULATE_SIGNED_ADD:
+			res[i] = a[i] * b[i] + c[i] - 0.5f;
+			break;
+
+		default:
+			res[i] = a[i];
+			break;
+		}
+
+		res[i] *= in->scale;
+		if(res[i] < 0.0f) res[i] = 0.0f;
+		if(res[i] > 1.0f) res[i] = 1.0f;
+	}
+}
@@ -0,0 +1,85 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _BAKE_H_
+#define _BAKE_H_
+
+#include "parser.h"
+#include "state.h"
+
+struct program;
+
+/* Baking of static subexpressions: the largest part of an expression
+ * that reads only textures which don't change, and constants, is
+ * evaluated once on the CPU into a texture of its own, which takes its
+ * place in the expression the state runs.
+ */
+
+struct bake {
+	struct ptree *tree;		/* the parsed expression, owning the nodes */
+	struct ptree *sub;		/* the static subtree, detached from it */
+	struct program *prog;	/* sub, lowered like the units would run it */
+	struct ptree leaf;		/* the baked texture, where sub used to be */
+	int slot;				/* texture slot of the baked texture */
+	unsigned int slots;		/* static texture slots sub reads (bit N for tN) */
+	unsigned int tex;		/* the baked texture, 0 until it's baked */
+	int stale;				/* a static texture changed since */
+
+	/* the state, and its setup before baking */
+	struct mtexp *state;
+	const struct compiled *orig_comp;
+	int orig_own;
+
+	struct compiled *comp;	/* the rest of the expression */
+	unsigned int *key;		/* sort key of the state, if it didn't fit */
+
+	struct bake *next;		/* list of all the bakes */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* returns the link to the largest static operator subtree of the tree
+ * rooted at *root, or null if there is none. Textures with their bit set
+ * in dynamic (tN for bit N), and the primary color, aren't static.
+ */
+struct ptree **mtexp_find_static(struct ptree **root, unsigned int dynamic);
+
+/* the texture slots a tree reads, bit N for tN */
+unsigned int mtexp_tree_slots(const struct ptree *t);
+
+/* evaluates the static subtree with the textures of the state, into the
+ * baked texture. Returns -1 if a texture can't be read back.
+ */
+int mtexp_bake(struct bake *bake);
+
+/* adds a bake to the ones mtexp_texture_changed looks through, or
+ * removes it and deletes its texture.
+ */
+void mtexp_bake_add(struct bake *bake);
+void mtexp_bake_remove(struct bake *bake);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _BAKE_H_ */
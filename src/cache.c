@@ -0,0 +1,157 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "mtexp.h"
+#include "state.h"
+
+struct entry {
+	char *expr;
+	unsigned int hash;
+	struct compiled *comp;
+	struct entry *next;
+};
+
+struct mtexp_cache {
+	struct entry **bucket;
+	int size, count;
+};
+
+static unsigned int hash_str(const char *str);
+static int grow(struct mtexp_cache *cache);
+
+struct mtexp_cache *mtexp_cache_create(void) {
+	struct mtexp_cache *cache;
+
+	if(!(cache = malloc(sizeof *cache))) return 0;
+
+	cache->size = 64;
+	cache->count = 0;
+	if(!(cache->bucket = calloc(cache->size, sizeof *cache->bucket))) {
+		free(cache);
+		return 0;
+	}
+	return cache;
+}
+
+void mtexp_cache_free(struct mtexp_cache *cache) {
+	int i;
+
+	if(!cache) return;
+
+	for(i=0; i<cache->size; i++) {
+		struct entry *e = cache->bucket[i];
+		while(e) {
+			struct entry *tmp = e;
+			e = e->next;
+
+			mtexp_free_compiled(tmp->comp);
+			free(tmp->expr);
+			free(tmp);
+		}
+	}
+	free(cache->bucket);
+	free(cache);
+}
+
+struct mtexp *mtexp_create_cached(struct mtexp_cache *cache, const char *expr, ...) {
+	va_list arg_list;
+	unsigned int hash = hash_str(expr);
+	struct entry *e;
+	struct mtexp *ts;
+	unsigned int caps = mtexp_get_caps();
+	int max_units = gls_get_max_units();
+
+	/* the same expression compiles differently for different features */
+	e = cache->bucket[hash % cache->size];
+	while(e && (e->hash != hash || e->comp->caps != caps || e->comp->max_units != max_units ||
+				strcmp(e->expr, expr) != 0)) {
+		e = e->next;
+	}
+
+	if(!e) {
+		/* first time we see this expression, compile it */
+		int idx;
+
+		if(cache->count >= cache->size && grow(cache) == -1) {
+			return 0;
+		}
+		if(!(e = malloc(sizeof *e))) {
+			return 0;
+		}
+		if(!(e->expr = malloc(strlen(expr) + 1)) || !(e->comp = mtexp_compile_expr(expr))) {
+			free(e->expr);
+			free(e);
+			return 0;
+		}
+		strcpy(e->expr, expr);
+		e->hash = hash;
+
+		idx = hash % cache->size;
+		e->next = cache->bucket[idx];
+		cache->bucket[idx] = e;
+		cache->count++;
+	}
+
+	va_start(arg_list, expr);
+	ts = mtexp_create_state(e->comp, 0, arg_list);
+	va_end(arg_list);
+
+	return ts;
+}
+
+/* djb2 */
+static unsigned int hash_str(const char *str) {
+	unsigned int hash = 5381;
+
+	while(*str) {
+		hash = hash * 33 + *str++;
+	}
+	return hash;
+}
+
+static int grow(struct mtexp_cache *cache) {
+	int i, new_size = cache->size * 2;
+	struct entry **new_bucket;
+
+	if(!(new_bucket = calloc(new_size, sizeof *new_bucket))) {
+		return -1;
+	}
+
+	for(i=0; i<cache->size; i++) {
+		struct entry *e = cache->bucket[i];
+		while(e) {
+			struct entry *next = e->next;
+			int idx = e->hash % new_size;
+
+			e->next = new_bucket[idx];
+			new_bucket[idx] = e;
+			e = next;
+		}
+	}
+	free(cache->bucket);
+	cache->bucket = new_bucket;
+	cache->size = new_size;
+	return 0;
+}
@@ -0,0 +1,554 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mtexp.h"
+#include "glstate.h"
+
+/* size of the images of mock textures, read back as GL_RGBA bytes */
+#define MOCK_TEX_SIZE	2
+
+/* fragment shader limits, those of common OpenGL 2.0 hardware */
+#define MOCK_SHADER_UNITS	16
+#define MOCK_SHADER_COORDS	8
+
+static void mock_active_texture(unsigned int unit);
+static void mock_client_active_texture(unsigned int unit);
+static void mock_tex_envi(unsigned int target, unsigned int pname, int val);
+static void mock_tex_envfv(unsigned int target, unsigned int pname, const float *val);
+static void mock_bind_texture(unsigned int target, unsigned int tex);
+static void mock_enable(unsigned int cap);
+static void mock_disable(unsigned int cap);
+static unsigned int mock_get_error(void);
+static const char *mock_get_string(unsigned int name);
+static void mock_get_integerv(unsigned int pname, int *val);
+static void mock_blend_func(unsigned int src, unsigned int dst);
+static void mock_gen_textures(int n, unsigned int *tex);
+static void mock_delete_textures(int n, const unsigned int *tex);
+static void mock_tex_image_2d(unsigned int target, int level, int ifmt, int width, int height, int border, unsigned int fmt, unsigned int type, const void *pixels);
+static void mock_tex_parameteri(unsigned int target, unsigned int pname, int val);
+static void mock_copy_tex_sub_image_2d(unsigned int target, int level, int xoffs, int yoffs, int x, int y, int width, int height);
+static void mock_tex_geni(unsigned int coord, unsigned int pname, int val);
+static void mock_tex_genfv(unsigned int coord, unsigned int pname, const float *val);
+static void mock_matrix_mode(unsigned int mode);
+static void mock_push_matrix(void);
+static void mock_pop_matrix(void);
+static void mock_load_matrixf(const float *mat);
+static void mock_get_floatv(unsigned int pname, float *val);
+static void mock_get_tex_level_parameteriv(unsigned int target, int level, unsigned int pname, int *val);
+static void mock_get_tex_image(unsigned int target, int level, unsigned int fmt, unsigned int type, void *pixels);
+static unsigned int mock_create_shader(unsigned int type);
+static void mock_shader_source(unsigned int sdr, const char *src);
+static void mock_compile_shader(unsigned int sdr);
+static void mock_get_shaderiv(unsigned int sdr, unsigned int pname, int *val);
+static void mock_get_shader_info_log(unsigned int sdr, int size, char *buf);
+static void mock_delete_shader(unsigned int sdr);
+static unsigned int mock_create_program(void);
+static void mock_attach_shader(unsigned int prog, unsigned int sdr);
+static void mock_link_program(unsigned int prog);
+static void mock_get_programiv(unsigned int prog, unsigned int pname, int *val);
+static void mock_get_program_info_log(unsigned int prog, int size, char *buf);
+static void mock_delete_program(unsigned int prog);
+static void mock_use_program(unsigned int prog);
+static int mock_get_uniform_location(unsigned int prog, const char *name);
+static void mock_uniform1i(int loc, int val);
+static void mock_uniform4fv(int loc, int count, const float *val);
+
+static struct mtexp_mock_call *record(int func, unsigned int a0, unsigned int a1);
+
+static struct mtexp_gl mock_gl = {
+	mock_active_texture,
+	mock_client_active_texture,
+	mock_tex_envi,
+	mock_tex_envfv,
+	mock_bind_texture,
+	mock_enable,
+	mock_disable,
+	mock_get_error,
+	mock_get_string,
+	mock_get_integerv,
+	mock_blend_func,
+	mock_gen_textures,
+	mock_delete_textures,
+	mock_tex_image_2d,
+	mock_tex_parameteri,
+	mock_copy_tex_sub_image_2d,
+	mock_tex_geni,
+	mock_tex_genfv,
+	mock_matrix_mode,
+	mock_push_matrix,
+	mock_pop_matrix,
+	mock_load_matrixf,
+	mock_get_floatv,
+	mock_get_tex_level_parameteriv,
+	mock_get_tex_image,
+	mock_create_shader,
+	mock_shader_source,
+	mock_compile_shader,
+	mock_get_shaderiv,
+	mock_get_shader_info_log,
+	mock_delete_shader,
+	mock_create_program,
+	mock_attach_shader,
+	mock_link_program,
+	mock_get_programiv,
+	mock_get_program_info_log,
+	mock_delete_program,
+	mock_use_program,
+	mock_get_uniform_location,
+	mock_uniform1i,
+	mock_uniform4fv
+};
+
+static const char *func_name[] = {
+	"glActiveTexture",
+	"glClientActiveTexture",
+	"glTexEnvi",
+	"glTexEnvfv",
+	"glBindTexture",
+	"glEnable",
+	"glDisable",
+	"glGetError",
+	"glGetString",
+	"glGetIntegerv",
+	"glBlendFunc",
+	"glGenTextures",
+	"glDeleteTextures",
+	"glTexImage2D",
+	"glTexParameteri",
+	"glCopyTexSubImage2D",
+	"glTexGeni",
+	"glTexGenfv",
+	"glMatrixMode",
+	"glPushMatrix",
+	"glPopMatrix",
+	"glLoadMatrixf",
+	"glGetFloatv",
+	"glGetTexLevelParameteriv",
+	"glGetTexImage",
+	"glCreateShader",
+	"glShaderSource",
+	"glCompileShader",
+	"glGetShaderiv",
+	"glGetShaderInfoLog",
+	"glDeleteShader",
+	"glCreateProgram",
+	"glAttachShader",
+	"glLinkProgram",
+	"glGetProgramiv",
+	"glGetProgramInfoLog",
+	"glDeleteProgram",
+	"glUseProgram",
+	"glGetUniformLocation",
+	"glUniform1i",
+	"glUniform4fv"
+};
+
+/* call log */
+static struct mtexp_mock_call *log_buf;
+static int log_count, log_size;
+
+/* texture objects and their targets */
+static struct mock_tex {
+	unsigned int tex;
+	unsigned int target;
+} *textures;
+static int tex_count, tex_size;
+
+static unsigned int error;
+static const char *extensions = "";
+static const char *version = "1.3 mock";	/* texture_env_combine is the least we need */
+static int max_units = 8;
+static int viewport[4] = {0, 0, 640, 480};
+static unsigned int next_tex = 1000;	/* names of generated textures */
+static unsigned int last_bound;		/* the texture read back by glGetTexImage */
+static unsigned int next_obj = 2000;	/* names of shaders and programs */
+static int next_loc;				/* uniform locations, a new one every time */
+
+const struct mtexp_gl *mtexp_mock_gl(void) {
+	return &mock_gl;
+}
+
+const struct mtexp_mock_call *mtexp_mock_log(int *count) {
+	*count = log_count;
+	return log_buf;
+}
+
+void mtexp_mock_reset(int textures) {
+	log_count = 0;
+	error = GL_NO_ERROR;
+	if(textures) tex_count = 0;
+}
+
+void mtexp_mock_texture(unsigned int tex, unsigned int target) {
+	int i;
+
+	for(i=0; i<tex_count; i++) {
+		if(textures[i].tex == tex) {
+			textures[i].target = target;
+			return;
+		}
+	}
+
+	if(tex_count >= tex_size) {
+		int new_size = tex_size ? tex_size * 2 : 32;
+		struct mock_tex *tmp;
+
+		if(!(tmp = realloc(textures, new_size * sizeof *tmp))) {
+			return;
+		}
+		textures = tmp;
+		tex_size = new_size;
+	}
+	textures[tex_count].tex = tex;
+	textures[tex_count++].target = target;
+}
+
+void mtexp_mock_extensions(const char *ext) {
+	extensions = ext ? ext : "";
+}
+
+void mtexp_mock_version(const char *ver) {
+	version = ver ? ver : "1.3 mock";
+}
+
+void mtexp_mock_max_units(int units) {
+	max_units = units;
+}
+
+void mtexp_mock_viewport(int x, int y, int width, int height) {
+	viewport[0] = x;
+	viewport[1] = y;
+	viewport[2] = width;
+	viewport[3] = height;
+}
+
+const char *mtexp_mock_func_name(int func) {
+	if(func < 0 || func >= (int)(sizeof func_name / sizeof *func_name)) {
+		return "<unknown>";
+	}
+	return func_name[func];
+}
+
+static void mock_active_texture(unsigned int unit) {
+	record(MTEXP_GL_ACTIVE_TEXTURE, unit, 0);
+}
+
+static void mock_client_active_texture(unsigned int unit) {
+	record(MTEXP_GL_CLIENT_ACTIVE_TEXTURE, unit, 0);
+}
+
+static void mock_tex_envi(unsigned int target, unsigned int pname, int val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_TEX_ENVI, target, pname);
+	if(c) c->val.i = val;
+}
+
+static void mock_tex_envfv(unsigned int target, unsigned int pname, const float *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_TEX_ENVFV, target, pname);
+	if(c) memcpy(c->val.f, val, sizeof c->val.f);
+}
+
+static void mock_bind_texture(unsigned int target, unsigned int tex) {
+	int i;
+
+	record(MTEXP_GL_BIND_TEXTURE, target, tex);
+	last_bound = tex;
+
+	if(tex) {
+		for(i=0; i<tex_count; i++) {
+			if(textures[i].tex == tex) {
+				if(textures[i].target != target) {
+					error = GL_INVALID_OPERATION;
+				}
+				return;
+			}
+		}
+		mtexp_mock_texture(tex, target);
+	}
+}
+
+static void mock_enable(unsigned int cap) {
+	record(MTEXP_GL_ENABLE, cap, 0);
+}
+
+static void mock_disable(unsigned int cap) {
+	record(MTEXP_GL_DISABLE, cap, 0);
+}
+
+static unsigned int mock_get_error(void) {
+	unsigned int err = error;
+
+	record(MTEXP_GL_GET_ERROR, 0, 0);
+	error = GL_NO_ERROR;
+	return err;
+}
+
+static const char *mock_get_string(unsigned int name) {
+	record(MTEXP_GL_GET_STRING, name, 0);
+
+	switch(name) {
+	case GL_EXTENSIONS:
+		return extensions;
+	case GL_VERSION:
+		return version;
+	default:
+		break;
+	}
+	return "";
+}
+
+static void mock_get_integerv(unsigned int pname, int *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_GET_INTEGERV, pname, 0);
+
+	switch(pname) {
+	case GL_MAX_TEXTURE_UNITS:
+		*val = max_units;
+		break;
+
+	case GL_MAX_TEXTURE_IMAGE_UNITS:
+		*val = MOCK_SHADER_UNITS;
+		break;
+
+	case GL_MAX_TEXTURE_COORDS:
+		*val = MOCK_SHADER_COORDS;
+		break;
+
+	case GL_VIEWPORT:
+		memcpy(val, viewport, sizeof viewport);
+		break;
+
+	case GL_MATRIX_MODE:
+		*val = GL_MODELVIEW;
+		break;
+
+	default:
+		break;
+	}
+	if(c) c->val.i = *val;
+}
+
+static void mock_blend_func(unsigned int src, unsigned int dst) {
+	record(MTEXP_GL_BLEND_FUNC, src, dst);
+}
+
+static void mock_gen_textures(int n, unsigned int *tex) {
+	int i;
+
+	record(MTEXP_GL_GEN_TEXTURES, n, next_tex);
+	for(i=0; i<n; i++) {
+		tex[i] = next_tex++;
+	}
+}
+
+static void mock_delete_textures(int n, const unsigned int *tex) {
+	record(MTEXP_GL_DELETE_TEXTURES, n, n > 0 ? tex[0] : 0);
+}
+
+static void mock_tex_image_2d(unsigned int target, int level, int ifmt, int width, int height,
+		int border, unsigned int fmt, unsigned int type, const void *pixels) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_TEX_IMAGE_2D, target, ifmt);
+
+	if(c) {
+		c->val.f[0] = (float)width;
+		c->val.f[1] = (float)height;
+	}
+}
+
+static void mock_tex_parameteri(unsigned int target, unsigned int pname, int val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_TEX_PARAMETERI, target, pname);
+	if(c) c->val.i = val;
+}
+
+static void mock_copy_tex_sub_image_2d(unsigned int target, int level, int xoffs, int yoffs,
+		int x, int y, int width, int height) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_COPY_TEX_SUB_IMAGE_2D, target, level);
+
+	if(c) {
+		c->val.f[0] = (float)x;
+		c->val.f[1] = (float)y;
+		c->val.f[2] = (float)width;
+		c->val.f[3] = (float)height;
+	}
+}
+
+static void mock_tex_geni(unsigned int coord, unsigned int pname, int val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_TEX_GENI, coord, pname);
+	if(c) c->val.i = val;
+}
+
+static void mock_tex_genfv(unsigned int coord, unsigned int pname, const float *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_TEX_GENFV, coord, pname);
+	if(c) memcpy(c->val.f, val, sizeof c->val.f);
+}
+
+static void mock_matrix_mode(unsigned int mode) {
+	record(MTEXP_GL_MATRIX_MODE, mode, 0);
+}
+
+static void mock_push_matrix(void) {
+	record(MTEXP_GL_PUSH_MATRIX, 0, 0);
+}
+
+static void mock_pop_matrix(void) {
+	record(MTEXP_GL_POP_MATRIX, 0, 0);
+}
+
+static void mock_load_matrixf(const float *mat) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_LOAD_MATRIXF, 0, 0);
+	if(c) memcpy(c->val.f, mat, sizeof c->val.f);
+}
+
+/* every matrix is the identity */
+static void mock_get_floatv(unsigned int pname, float *val) {
+	int i;
+
+	record(MTEXP_GL_GET_FLOATV, pname, 0);
+
+	if(pname == GL_PROJECTION_MATRIX || pname == GL_MODELVIEW_MATRIX || pname == GL_TEXTURE_MATRIX) {
+		for(i=0; i<16; i++) {
+			val[i] = i % 5 == 0 ? 1.0f : 0.0f;
+		}
+	}
+}
+
+/* every texture is MOCK_TEX_SIZE x MOCK_TEX_SIZE */
+static void mock_get_tex_level_parameteriv(unsigned int target, int level, unsigned int pname, int *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_GET_TEX_LEVEL_PARAMETERIV, target, pname);
+
+	if(pname == GL_TEXTURE_WIDTH || pname == GL_TEXTURE_HEIGHT) {
+		*val = MOCK_TEX_SIZE;
+	}
+	if(c) c->val.i = *val;
+}
+
+/* all the bytes of texture N are N modulo 256 */
+static void mock_get_tex_image(unsigned int target, int level, unsigned int fmt, unsigned int type, void *pixels) {
+	record(MTEXP_GL_GET_TEX_IMAGE, target, last_bound);
+	memset(pixels, last_bound & 0xff, MOCK_TEX_SIZE * MOCK_TEX_SIZE * 4);
+}
+
+static unsigned int mock_create_shader(unsigned int type) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_CREATE_SHADER, type, 0);
+
+	if(c) c->val.i = next_obj;
+	return next_obj++;
+}
+
+static void mock_shader_source(unsigned int sdr, const char *src) {
+	record(MTEXP_GL_SHADER_SOURCE, sdr, strlen(src));
+}
+
+static void mock_compile_shader(unsigned int sdr) {
+	record(MTEXP_GL_COMPILE_SHADER, sdr, 0);
+}
+
+/* every shader compiles */
+static void mock_get_shaderiv(unsigned int sdr, unsigned int pname, int *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_GET_SHADERIV, sdr, pname);
+
+	*val = pname == GL_COMPILE_STATUS ? 1 : 0;
+	if(c) c->val.i = *val;
+}
+
+static void mock_get_shader_info_log(unsigned int sdr, int size, char *buf) {
+	record(MTEXP_GL_GET_SHADER_INFO_LOG, sdr, size);
+	if(size > 0) *buf = 0;
+}
+
+static void mock_delete_shader(unsigned int sdr) {
+	record(MTEXP_GL_DELETE_SHADER, sdr, 0);
+}
+
+static unsigned int mock_create_program(void) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_CREATE_PROGRAM, 0, 0);
+
+	if(c) c->val.i = next_obj;
+	return next_obj++;
+}
+
+static void mock_attach_shader(unsigned int prog, unsigned int sdr) {
+	record(MTEXP_GL_ATTACH_SHADER, prog, sdr);
+}
+
+static void mock_link_program(unsigned int prog) {
+	record(MTEXP_GL_LINK_PROGRAM, prog, 0);
+}
+
+/* and every program links */
+static void mock_get_programiv(unsigned int prog, unsigned int pname, int *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_GET_PROGRAMIV, prog, pname);
+
+	*val = pname == GL_LINK_STATUS ? 1 : 0;
+	if(c) c->val.i = *val;
+}
+
+static void mock_get_program_info_log(unsigned int prog, int size, char *buf) {
+	record(MTEXP_GL_GET_PROGRAM_INFO_LOG, prog, size);
+	if(size > 0) *buf = 0;
+}
+
+static void mock_delete_program(unsigned int prog) {
+	record(MTEXP_GL_DELETE_PROGRAM, prog, 0);
+}
+
+static void mock_use_program(unsigned int prog) {
+	record(MTEXP_GL_USE_PROGRAM, prog, 0);
+}
+
+static int mock_get_uniform_location(unsigned int prog, const char *name) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_GET_UNIFORM_LOCATION, prog, 0);
+
+	if(c) c->val.i = next_loc;
+	return next_loc++;
+}
+
+static void mock_uniform1i(int loc, int val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_UNIFORM1I, loc, 0);
+	if(c) c->val.i = val;
+}
+
+static void mock_uniform4fv(int loc, int count, const float *val) {
+	struct mtexp_mock_call *c = record(MTEXP_GL_UNIFORM4FV, loc, count);
+	if(c) memcpy(c->val.f, val, sizeof c->val.f);
+}
+
+static struct mtexp_mock_call *record(int func, unsigned int a0, unsigned int a1) {
+	struct mtexp_mock_call *c;
+
+	if(log_count >= log_size) {
+		int new_size = log_size ? log_size * 2 : 256;
+		struct mtexp_mock_call *tmp;
+
+		if(!(tmp = realloc(log_buf, new_size * sizeof *tmp))) {
+			return 0;
+		}
+		log_buf = tmp;
+		log_size = new_size;
+	}
+
+	c = log_buf + log_count++;
+	c->func = func;
+	c->arg[0] = a0;
+	c->arg[1] = a1;
+	c->val.i = 0;
+	return c;
+}
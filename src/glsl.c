@@ -0,0 +1,289 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "glsl.h"
+
+/* longest piece of source emitted at once */
+#define LINE_SIZE		256
+
+/* growing piece of source */
+struct text {
+	char *str;
+	int len, size;
+	int failed;
+};
+
+struct gen {
+	struct glsl_code *code;
+	struct text decl, body;
+	int *const_uniform;	/* kN of each constant of both programs, -1 if not declared */
+	char *sampled;		/* textures already read into sN */
+};
+
+static void gen_program(struct gen *g, const struct program *prog, int const_base, char *name);
+static void gen_alpha_product(struct gen *g, const struct program *prog, char *name);
+static void gen_source(struct gen *g, const struct program *prog, const struct instr *in, int i, int const_base, char *name);
+static void emit(struct text *txt, const char *fmt, ...);
+
+/* ---- public interface ---- */
+
+/* --- mtexp_glsl_gen() ---
+ * Every instruction becomes a temporary of its own, saturated once like
+ * the output of a combiner, and the textures are read once each at
+ * their first use.
+ */
+int mtexp_glsl_gen(struct glsl_code *code, const struct program *rgb, const struct program *alpha) {
+	struct gen g;
+	char rgb_name[32], alpha_name[LINE_SIZE / 2];
+	int i, consts, slots, res = -1;
+
+	slots = rgb->tex_count;
+	consts = rgb->const_count;
+	if(alpha) {
+		if(alpha->tex_count > slots) slots = alpha->tex_count;
+		consts += alpha->const_count;
+	}
+
+	code->src = 0;
+	code->const_count = 0;
+	code->tex_count = slots;
+
+	memset(&g, 0, sizeof g);
+	g.code = code;
+	g.sampled = calloc(slots + 1, 1);
+	g.const_uniform = malloc((consts + 1) * sizeof *g.const_uniform);
+	code->consts = malloc((consts + 1) * sizeof *code->consts);
+
+	if(g.sampled && g.const_uniform && code->consts) {
+		for(i=0; i<consts; i++) {
+			g.const_uniform[i] = -1;
+		}
+
+		gen_program(&g, rgb, 0, rgb_name);
+		if(alpha) {
+			gen_program(&g, alpha, rgb->const_count, alpha_name);
+		} else {
+			gen_alpha_product(&g, rgb, alpha_name);
+		}
+		emit(&g.body, "\tgl_FragColor = vec4(%s, %s);\n}\n", rgb_name, alpha_name);
+		emit(&g.decl, "\nvoid main()\n{\n");
+
+		if(!g.decl.failed && !g.body.failed && (code->src = malloc(g.decl.len + g.body.len + 1))) {
+			memcpy(code->src, g.decl.str, g.decl.len);
+			memcpy(code->src + g.decl.len, g.body.str, g.body.len + 1);
+			res = 0;
+		}
+	}
+
+	free(g.decl.str);
+	free(g.body.str);
+	free(g.const_uniform);
+	free(g.sampled);
+	if(res == -1) mtexp_glsl_free(code);
+	return res;
+}
+
+void mtexp_glsl_free(struct glsl_code *code) {
+	free(code->src);
+	free(code->consts);
+	code->src = 0;
+	code->consts = 0;
+	code->const_count = 0;
+}
+
+/* ---------- local functions ----------- */
+
+/* --- gen_program() ---
+ * emits instruction i as the temporary ri (vec3) of a color program, or
+ * ai (float) of an alpha one, and writes the name of the result, which
+ * the last instruction computes, to name.
+ */
+static void gen_program(struct gen *g, const struct program *prog, int const_base, char *name) {
+	char src[3][32], expr[LINE_SIZE / 2];
+	int i, j, alpha = prog->flags & PROG_ALPHA;
+
+	for(i=0; i<prog->count; i++) {
+		const struct instr *in = prog->code + i;
+
+		for(j=0; j<MAX_SOURCES; j++) {
+			gen_source(g, prog, in, j, const_base, src[j]);
+		}
+
+		switch(in->op) {
+		case OP_ADD:
+			sprintf(expr, "%s + %s", src[0], src[1]);
+			break;
+
+		case OP_SUB:
+			sprintf(expr, "%s - %s", src[0], src[1]);
+			break;
+
+		case OP_MUL:
+			sprintf(expr, "%s * %s", src[0], src[1]);
+			break;
+
+		case OP_DOT:
+			/* never shows up in alpha programs */
+			sprintf(expr, "vec3(4.0 * dot(%s - 0.5, %s - 0.5))", src[0], src[1]);
+			break;
+
+		case OP_INTERPOLATE:
+			sprintf(expr, "mix(%s, %s, %s)", src[1], src[0], src[2]);
+			break;
+
+		case OP_ADD_SIGNED:
+			sprintf(expr, "%s + %s - 0.5", src[0], src[1]);
+			break;
+
+		case OP_MODULATE_ADD:
+			sprintf(expr, "%s * %s + %s", src[0], src[1], src[2]);
+			break;
+
+		case OP_MODULATE_SIGNED_ADD:
+			sprintf(expr, "%s * %s + %s - 0.5", src[0], src[1], src[2]);
+			break;
+
+		default:
+			strcpy(expr, src[0]);
+			break;
+		}
+
+		if(in->scale > 1) {
+			emit(&g->body, "\t%s %c%d = clamp((%s) * %d.0, 0.0, 1.0);\n", alpha ? "float" : "vec3",
+					alpha ? 'a' : 'r', i, expr, in->scale);
+		} else {
+			emit(&g->body, "\t%s %c%d = clamp(%s, 0.0, 1.0);\n", alpha ? "float" : "vec3",
+					alpha ? 'a' : 'r', i, expr);
+		}
+	}
+	sprintf(name, "%c%d", alpha ? 'a' : 'r', prog->count - 1);
+}
+
+/* --- gen_alpha_product() ---
+ * the alpha without an alpha program: the units modulate the alpha of
+ * their texture into the primary one. Without the crossbar every
+ * instruction reading a texture runs on a unit bound to it, with the
+ * crossbar every texture gets a unit of its own. Lines are short enough
+ * for a few factors, longer products go through mN temporaries.
+ */
+static void gen_alpha_product(struct gen *g, const struct program *prog, char *name) {
+	int i, j, slot, temps = 0;
+	char *counted;
+
+	if(!(counted = calloc(prog->tex_count + 1, 1))) {
+		g->body.failed = 1;
+		return;
+	}
+
+	strcpy(name, "gl_Color.a");
+	for(i=0; i<prog->count; i++) {
+		const struct instr *in = prog->code + i;
+
+		for(j=0; j<MAX_SOURCES; j++) {
+			if(in->src[j] != SRC_TEX) continue;
+
+			slot = in->arg[j];
+			if(prog->flags & PROG_CROSSBAR) {
+				if(counted[slot]) continue;
+				counted[slot] = 1;
+			}
+
+			if(strlen(name) > LINE_SIZE / 2 - 32) {
+				emit(&g->body, "\tfloat m%d = %s;\n", temps, name);
+				sprintf(name, "m%d", temps++);
+			}
+			sprintf(name + strlen(name), " * s%d.a", slot);
+
+			/* the other sources read the same texture */
+			if(!(prog->flags & PROG_CROSSBAR)) break;
+		}
+	}
+	free(counted);
+}
+
+/* names source j of an instruction, declaring its uniform first */
+static void gen_source(struct gen *g, const struct program *prog, const struct instr *in, int i, int const_base, char *name) {
+	struct glsl_code *code = g->code;
+	int alpha = prog->flags & PROG_ALPHA, arg = in->arg[i];
+	const char *part = alpha ? "a" : "rgb";
+	int *k;
+
+	switch(in->src[i]) {
+	case SRC_PREV:
+		sprintf(name, "%c%d", alpha ? 'a' : 'r', arg);
+		break;
+
+	case SRC_TEX:
+		if(!g->sampled[arg]) {
+			emit(&g->decl, "uniform sampler2D t%d;\n", arg);
+			emit(&g->body, "\tvec4 s%d = texture2D(t%d, gl_TexCoord[%d].st);\n", arg, arg, arg);
+			g->sampled[arg] = 1;
+		}
+		sprintf(name, "s%d.%s", arg, part);
+		break;
+
+	case SRC_CONST:
+		k = g->const_uniform + const_base + arg;
+		if(*k == -1) {
+			*k = code->const_count++;
+			emit(&g->decl, "uniform vec4 k%d;\n", *k);
+			memcpy(code->consts[*k], prog->consts[arg], sizeof code->consts[*k]);
+		}
+		sprintf(name, "k%d.%s", *k, part);
+		break;
+
+	default:
+		sprintf(name, "gl_Color.%s", part);
+		break;
+	}
+}
+
+static void emit(struct text *txt, const char *fmt, ...) {
+	va_list ap;
+	char line[LINE_SIZE];
+	int len;
+
+	va_start(ap, fmt);
+	len = vsprintf(line, fmt, ap);
+	va_end(ap);
+
+	if(txt->failed) return;
+
+	if(txt->len + len + 1 > txt->size) {
+		int new_size = txt->size ? txt->size * 2 : 512;
+		char *tmp;
+
+		while(new_size < txt->len + len + 1) new_size *= 2;
+
+		if(!(tmp = realloc(txt->str, new_size))) {
+			txt->failed = 1;
+			return;
+		}
+		txt->str = tmp;
+		txt->size = new_size;
+	}
+	memcpy(txt->str + txt->len, line, len + 1);
+	txt->len += len;
+}
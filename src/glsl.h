@@ -0,0 +1,62 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _GLSL_H_
+#define _GLSL_H_
+
+#include "program.h"
+
+/* GLSL backend: the whole expression is generated as a fragment shader,
+ * which runs in a single pass on OpenGL 2.0 implementations instead of
+ * the texture units. Generating the source needs no OpenGL context.
+ *
+ * Texture tN is the sampler2D uniform tN, read at gl_TexCoord[N], the
+ * primary color is gl_Color, and every constant is a vec4 uniform kN.
+ * Operators saturate like the combiners do.
+ */
+
+struct glsl_code {
+	char *src;				/* the fragment shader */
+	float (*consts)[4];		/* values of the uniforms k0, k1 ... */
+	int const_count;
+	int tex_count;			/* samplers t0 up to the highest one used */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* generates the shader of a color program, and of the alpha program if
+ * there is one, with the same saturation as the combiners running the
+ * programs. Without an alpha program, the alpha is the product of the
+ * primary alpha and the alpha of the texture of every unit, like the
+ * default alpha combiners. Returns -1 if out of memory.
+ */
+int mtexp_glsl_gen(struct glsl_code *code, const struct program *rgb, const struct program *alpha);
+
+/* frees the source and the constants */
+void mtexp_glsl_free(struct glsl_code *code);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _GLSL_H_ */
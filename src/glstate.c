@@ -0,0 +1,938 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#if defined(__unix__)
+#include <GL/glx.h>
+#endif
+#include "mtexp.h"
+#include "glstate.h"
+
+#if defined(__unix__)
+#define get_proc_address(s)	glXGetProcAddress((const GLubyte*)(s))
+#elif defined(WIN32)
+#define get_proc_address(s)	wglGetProcAddress(s)
+#endif
+
+static PFNGLACTIVETEXTUREARBPROC gl_active_texture;
+static PFNGLCLIENTACTIVETEXTUREARBPROC gl_client_active_texture;
+
+/* OpenGL 2.0 entry points of the GLSL backend */
+typedef GLuint (APIENTRY *create_shader_proc)(GLenum type);
+typedef void (APIENTRY *shader_source_proc)(GLuint sdr, GLsizei count, const char **src, const GLint *len);
+typedef void (APIENTRY *object_proc)(GLuint obj);
+typedef void (APIENTRY *get_objectiv_proc)(GLuint obj, GLenum pname, GLint *val);
+typedef void (APIENTRY *get_info_log_proc)(GLuint obj, GLsizei size, GLsizei *len, char *buf);
+typedef GLuint (APIENTRY *create_program_proc)(void);
+typedef void (APIENTRY *attach_shader_proc)(GLuint prog, GLuint sdr);
+typedef GLint (APIENTRY *get_uniform_location_proc)(GLuint prog, const char *name);
+typedef void (APIENTRY *uniform1i_proc)(GLint loc, GLint val);
+typedef void (APIENTRY *uniform4fv_proc)(GLint loc, GLsizei count, const GLfloat *val);
+
+static create_shader_proc gl_create_shader;
+static shader_source_proc gl_shader_source;
+static object_proc gl_compile_shader, gl_delete_shader, gl_link_program, gl_delete_program, gl_use_program;
+static get_objectiv_proc gl_get_shaderiv, gl_get_programiv;
+static get_info_log_proc gl_get_shader_info_log, gl_get_program_info_log;
+static create_program_proc gl_create_program;
+static attach_shader_proc gl_attach_shader;
+static get_uniform_location_proc gl_get_uniform_location;
+static uniform1i_proc gl_uniform1i;
+static uniform4fv_proc gl_uniform4fv;
+
+/* default dispatch table functions, calling OpenGL */
+static void def_active_texture(unsigned int unit);
+static void def_client_active_texture(unsigned int unit);
+static void def_tex_envi(unsigned int target, unsigned int pname, int val);
+static void def_tex_envfv(unsigned int target, unsigned int pname, const float *val);
+static void def_bind_texture(unsigned int target, unsigned int tex);
+static void def_enable(unsigned int cap);
+static void def_disable(unsigned int cap);
+static unsigned int def_get_error(void);
+static const char *def_get_string(unsigned int name);
+static void def_get_integerv(unsigned int pname, int *val);
+static void def_blend_func(unsigned int src, unsigned int dst);
+static void def_gen_textures(int n, unsigned int *tex);
+static void def_delete_textures(int n, const unsigned int *tex);
+static void def_tex_image_2d(unsigned int target, int level, int ifmt, int width, int height, int border, unsigned int fmt, unsigned int type, const void *pixels);
+static void def_tex_parameteri(unsigned int target, unsigned int pname, int val);
+static void def_copy_tex_sub_image_2d(unsigned int target, int level, int xoffs, int yoffs, int x, int y, int width, int height);
+static void def_tex_geni(unsigned int coord, unsigned int pname, int val);
+static void def_tex_genfv(unsigned int coord, unsigned int pname, const float *val);
+static void def_matrix_mode(unsigned int mode);
+static void def_push_matrix(void);
+static void def_pop_matrix(void);
+static void def_load_matrixf(const float *mat);
+static void def_get_floatv(unsigned int pname, float *val);
+static void def_get_tex_level_parameteriv(unsigned int target, int level, unsigned int pname, int *val);
+static void def_get_tex_image(unsigned int target, int level, unsigned int fmt, unsigned int type, void *pixels);
+static unsigned int def_create_shader(unsigned int type);
+static void def_shader_source(unsigned int sdr, const char *src);
+static void def_compile_shader(unsigned int sdr);
+static void def_get_shaderiv(unsigned int sdr, unsigned int pname, int *val);
+static void def_get_shader_info_log(unsigned int sdr, int size, char *buf);
+static void def_delete_shader(unsigned int sdr);
+static unsigned int def_create_program(void);
+static void def_attach_shader(unsigned int prog, unsigned int sdr);
+static void def_link_program(unsigned int prog);
+static void def_get_programiv(unsigned int prog, unsigned int pname, int *val);
+static void def_get_program_info_log(unsigned int prog, int size, char *buf);
+static void def_delete_program(unsigned int prog);
+static void def_use_program(unsigned int prog);
+static int def_get_uniform_location(unsigned int prog, const char *name);
+static void def_uniform1i(int loc, int val);
+static void def_uniform4fv(int loc, int count, const float *val);
+
+static struct mtexp_gl def_gl = {
+	def_active_texture,
+	def_client_active_texture,
+	def_tex_envi,
+	def_tex_envfv,
+	def_bind_texture,
+	def_enable,
+	def_disable,
+	def_get_error,
+	def_get_string,
+	def_get_integerv,
+	def_blend_func,
+	def_gen_textures,
+	def_delete_textures,
+	def_tex_image_2d,
+	def_tex_parameteri,
+	def_copy_tex_sub_image_2d,
+	def_tex_geni,
+	def_tex_genfv,
+	def_matrix_mode,
+	def_push_matrix,
+	def_pop_matrix,
+	def_load_matrixf,
+	def_get_floatv,
+	def_get_tex_level_parameteriv,
+	def_get_tex_image,
+	def_create_shader,
+	def_shader_source,
+	def_compile_shader,
+	def_get_shaderiv,
+	def_get_shader_info_log,
+	def_delete_shader,
+	def_create_program,
+	def_attach_shader,
+	def_link_program,
+	def_get_programiv,
+	def_get_program_info_log,
+	def_delete_program,
+	def_use_program,
+	def_get_uniform_location,
+	def_uniform1i,
+	def_uniform4fv
+};
+
+static struct mtexp_gl gl;	/* current dispatch table */
+
+const GLenum gls_tex_type[] = {
+	GL_TEXTURE_1D,
+	GL_TEXTURE_2D,
+	GL_TEXTURE_3D,
+	GL_TEXTURE_CUBE_MAP,
+	0
+};
+#define NUM_TEX_TYPES	4
+
+/* texture environment parameters that are shadowed */
+static const GLenum env_param[] = {
+	GL_TEXTURE_ENV_MODE,
+	GL_COMBINE_RGB,
+	GL_SOURCE0_RGB,
+	GL_SOURCE1_RGB,
+	GL_SOURCE2_RGB,
+	GL_OPERAND2_RGB,
+	GL_SOURCE3_RGB_NV,
+	GL_OPERAND3_RGB_NV,
+	GL_RGB_SCALE,
+	GL_COMBINE_ALPHA,
+	GL_SOURCE0_ALPHA,
+	GL_SOURCE1_ALPHA,
+	GL_SOURCE2_ALPHA,
+	GL_SOURCE3_ALPHA_NV,
+	GL_OPERAND3_ALPHA_NV,
+	GL_ALPHA_SCALE
+};
+#define NUM_ENV_PARAMS	16
+
+#define UNKNOWN		(-1)
+
+static struct unit_shadow {
+	GLint env[NUM_ENV_PARAMS];
+	GLfloat color[4];
+	int color_known;
+
+	unsigned int bound[NUM_TEX_TYPES];
+	int bound_known[NUM_TEX_TYPES];
+	int enabled[NUM_TEX_TYPES];		/* 0, 1 or UNKNOWN */
+	int texgen;		/* screen space texgen of temporaries, 0, 1 or UNKNOWN */
+} shadow[GLS_MAX_UNITS];
+
+static int cur_unit;
+static struct mtexp_stats stats;
+
+/* GLSL program in use, set by states running a shader */
+static unsigned int cur_program;
+static int program_known;
+
+/* framebuffer blending, set by multipass states */
+static int blend_enabled;	/* 0, 1 or UNKNOWN */
+static GLenum blend_src, blend_dst;
+
+static unsigned int caps;
+static int caps_known;
+static int max_units = GLS_MAX_UNITS;
+static int max_shader_units;
+
+/* render to texture temporaries, 0 until they're first used */
+static unsigned int temp_tex[GLS_MAX_TEMPS];
+static int temp_width, temp_height;
+
+static const GLfloat identity[] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+static int env_index(GLenum pname);
+static void resize_temps(int width, int height);
+static int load_glsl(void);
+static int has_extension(const char *ext_str, const char *name);
+
+#define ISSUE(kind)		(stats.issued[kind]++)
+#define FILTER(kind)	(stats.filtered[kind]++)
+
+void gls_init(void) {
+	/* keep any dispatch table set before the first state was created */
+	if(!gl.active_texture) {
+		mtexp_set_gl(0);
+	}
+	gls_invalidate();
+
+	/* features and GL_MAX_TEXTURE_UNITS, retried later without a context */
+	gls_detect_caps();
+}
+
+void gls_invalidate(void) {
+	int i, j;
+
+	for(i=0; i<GLS_MAX_UNITS; i++) {
+		for(j=0; j<NUM_ENV_PARAMS; j++) {
+			shadow[i].env[j] = UNKNOWN;
+		}
+		shadow[i].color_known = 0;
+		shadow[i].texgen = UNKNOWN;
+
+		for(j=0; j<NUM_TEX_TYPES; j++) {
+			shadow[i].bound_known[j] = 0;
+			shadow[i].enabled[j] = UNKNOWN;
+		}
+	}
+	cur_unit = UNKNOWN;
+	program_known = 0;
+	blend_enabled = UNKNOWN;
+	blend_src = blend_dst = 0;
+}
+
+void gls_active_unit(int unit) {
+	if(unit == cur_unit) {
+		FILTER(MTEXP_CALL_ACTIVE);
+		return;
+	}
+	ISSUE(MTEXP_CALL_ACTIVE);
+	gl.active_texture(GL_TEXTURE0 + unit);
+	gl.client_active_texture(GL_TEXTURE0 + unit);
+	cur_unit = unit;
+}
+
+void gls_tex_envi(GLenum pname, GLint val) {
+	int idx = env_index(pname);
+
+	if(idx != -1 && cur_unit >= 0 && cur_unit < GLS_MAX_UNITS) {
+		GLint *env = shadow[cur_unit].env;
+
+		if(env[idx] == val) {
+			FILTER(MTEXP_CALL_TEXENV);
+			return;
+		}
+		env[idx] = val;
+	}
+	ISSUE(MTEXP_CALL_TEXENV);
+	gl.tex_envi(GL_TEXTURE_ENV, pname, val);
+}
+
+void gls_tex_envfv(GLenum pname, const GLfloat *val) {
+	if(pname == GL_TEXTURE_ENV_COLOR && cur_unit >= 0 && cur_unit < GLS_MAX_UNITS) {
+		struct unit_shadow *sh = shadow + cur_unit;
+
+		if(sh->color_known && memcmp(sh->color, val, sizeof sh->color) == 0) {
+			FILTER(MTEXP_CALL_TEXENV);
+			return;
+		}
+		memcpy(sh->color, val, sizeof sh->color);
+		sh->color_known = 1;
+	}
+	ISSUE(MTEXP_CALL_TEXENV);
+	gl.tex_envfv(GL_TEXTURE_ENV, pname, val);
+}
+
+void gls_bind_texture(GLenum target, unsigned int tex) {
+	int idx = gls_target_index(target);
+
+	if(idx != -1 && cur_unit >= 0 && cur_unit < GLS_MAX_UNITS) {
+		struct unit_shadow *sh = shadow + cur_unit;
+
+		if(sh->bound_known[idx] && sh->bound[idx] == tex) {
+			FILTER(MTEXP_CALL_BIND);
+			return;
+		}
+		sh->bound[idx] = tex;
+		sh->bound_known[idx] = 1;
+	}
+	ISSUE(MTEXP_CALL_BIND);
+	gl.bind_texture(target, tex);
+}
+
+void gls_enable(GLenum target) {
+	int idx = gls_target_index(target);
+
+	if(idx != -1 && cur_unit >= 0 && cur_unit < GLS_MAX_UNITS) {
+		if(shadow[cur_unit].enabled[idx] == 1) {
+			FILTER(MTEXP_CALL_ENABLE);
+			return;
+		}
+		shadow[cur_unit].enabled[idx] = 1;
+	}
+	ISSUE(MTEXP_CALL_ENABLE);
+	gl.enable(target);
+}
+
+void gls_disable(GLenum target) {
+	int idx = gls_target_index(target);
+
+	if(idx != -1 && cur_unit >= 0 && cur_unit < GLS_MAX_UNITS) {
+		if(shadow[cur_unit].enabled[idx] == 0) {
+			FILTER(MTEXP_CALL_ENABLE);
+			return;
+		}
+		shadow[cur_unit].enabled[idx] = 0;
+	}
+	ISSUE(MTEXP_CALL_ENABLE);
+	gl.disable(target);
+}
+
+void gls_blend(GLenum src, GLenum dst) {
+	if(!src) {
+		if(blend_enabled != 0) {
+			gl.disable(GL_BLEND);
+			blend_enabled = 0;
+		}
+		return;
+	}
+
+	if(blend_enabled != 1) {
+		gl.enable(GL_BLEND);
+		blend_enabled = 1;
+	}
+	if(src != blend_src || dst != blend_dst) {
+		gl.blend_func(src, dst);
+		blend_src = src;
+		blend_dst = dst;
+	}
+}
+
+unsigned int gls_temp_texture(int idx) {
+	if(!temp_tex[0]) {
+		gl.gen_textures(GLS_MAX_TEMPS, temp_tex);
+	}
+	return temp_tex[idx];
+}
+
+void gls_copy_temp(int idx) {
+	GLint vp[4];
+
+	gl.get_integerv(GL_VIEWPORT, vp);
+	if(vp[2] > temp_width || vp[3] > temp_height) {
+		resize_temps(vp[2], vp[3]);
+	}
+
+	gls_active_unit(0);
+	gls_bind_texture(GL_TEXTURE_2D, gls_temp_texture(idx));
+	gl.copy_tex_sub_image_2d(GL_TEXTURE_2D, 0, 0, 0, vp[0], vp[1], vp[2], vp[3]);
+}
+
+/* --- gls_screen_texgen() ---
+ * The eye coordinates are generated as they are (planes specified with
+ * an identity modelview), and the texture matrix takes them through the
+ * projection, and from there to the corner of the temporary the viewport
+ * was copied to: s = (x / w + 1) / 2 * viewport width / texture width.
+ */
+void gls_screen_texgen(int enable) {
+	static const GLenum coord[] = {GL_S, GL_T, GL_R, GL_Q};
+	static const GLenum gen[] = {GL_TEXTURE_GEN_S, GL_TEXTURE_GEN_T, GL_TEXTURE_GEN_R, GL_TEXTURE_GEN_Q};
+	GLfloat proj[16], mat[16], sx, sy;
+	GLint vp[4], mode;
+	int i, known = cur_unit >= 0 && cur_unit < GLS_MAX_UNITS;
+
+	if(!enable && known && shadow[cur_unit].texgen == 0) {
+		return;
+	}
+	if(known) shadow[cur_unit].texgen = enable;
+
+	gl.get_integerv(GL_MATRIX_MODE, &mode);
+
+	if(!enable) {
+		for(i=0; i<4; i++) {
+			gl.disable(gen[i]);
+		}
+		gl.matrix_mode(GL_TEXTURE);
+		gl.load_matrixf(identity);
+		gl.matrix_mode(mode);
+		return;
+	}
+
+	gl.matrix_mode(GL_MODELVIEW);
+	gl.push_matrix();
+	gl.load_matrixf(identity);
+	for(i=0; i<4; i++) {
+		gl.tex_geni(coord[i], GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+		gl.tex_genfv(coord[i], GL_EYE_PLANE, identity + i * 4);
+		gl.enable(gen[i]);
+	}
+	gl.pop_matrix();
+
+	gl.get_floatv(GL_PROJECTION_MATRIX, proj);
+	gl.get_integerv(GL_VIEWPORT, vp);
+	if(!temp_width) resize_temps(vp[2], vp[3]);
+	sx = 0.5f * vp[2] / temp_width;
+	sy = 0.5f * vp[3] / temp_height;
+
+	/* the matrices are column major */
+	memcpy(mat, proj, sizeof mat);
+	for(i=0; i<4; i++) {
+		mat[i * 4] = sx * (proj[i * 4] + proj[i * 4 + 3]);
+		mat[i * 4 + 1] = sy * (proj[i * 4 + 1] + proj[i * 4 + 3]);
+	}
+	gl.matrix_mode(GL_TEXTURE);
+	gl.load_matrixf(mat);
+	gl.matrix_mode(mode);
+}
+
+unsigned char *gls_read_texture(unsigned int tex, int *width, int *height) {
+	unsigned char *pixels;
+
+	gls_active_unit(0);
+	gls_bind_texture(GL_TEXTURE_2D, tex);
+
+	*width = *height = 0;
+	gl.get_tex_level_parameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, width);
+	gl.get_tex_level_parameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, height);
+
+	if(*width <= 0 || *height <= 0 || !(pixels = malloc(*width * *height * 4))) {
+		return 0;
+	}
+	gl.get_tex_image(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	return pixels;
+}
+
+void gls_upload_texture(unsigned int *tex, int width, int height, const unsigned char *pixels) {
+	int create = !*tex;
+
+	if(create) gl.gen_textures(1, tex);
+
+	gls_active_unit(0);
+	gls_bind_texture(GL_TEXTURE_2D, *tex);
+	gl.tex_image_2d(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+	if(create) {
+		gl.tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		gl.tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+}
+
+void gls_delete_texture(unsigned int tex) {
+	int i, j;
+
+	gl.delete_textures(1, &tex);
+
+	/* the name may come back from glGenTextures as anything */
+	for(i=0; i<GLS_MAX_UNITS; i++) {
+		for(j=0; j<NUM_TEX_TYPES; j++) {
+			if(shadow[i].bound[j] == tex) shadow[i].bound_known[j] = 0;
+		}
+	}
+}
+
+/* --- gls_link_shader() ---
+ * The shader object is only flagged for deletion once it's attached, and
+ * goes away along with the program.
+ */
+unsigned int gls_link_shader(const char *src) {
+	unsigned int sdr, prog;
+	int status = 0;
+	char log[1024];
+
+	if(!(sdr = gl.create_shader(GL_FRAGMENT_SHADER))) {
+		return 0;
+	}
+	gl.shader_source(sdr, src);
+	gl.compile_shader(sdr);
+	gl.get_shaderiv(sdr, GL_COMPILE_STATUS, &status);
+
+	if(!status) {
+		log[0] = 0;
+		gl.get_shader_info_log(sdr, sizeof log, log);
+		fprintf(stderr, "failed to compile the fragment shader:\n%s\n", log);
+		gl.delete_shader(sdr);
+		return 0;
+	}
+
+	if(!(prog = gl.create_program())) {
+		gl.delete_shader(sdr);
+		return 0;
+	}
+	gl.attach_shader(prog, sdr);
+	gl.delete_shader(sdr);
+	gl.link_program(prog);
+	gl.get_programiv(prog, GL_LINK_STATUS, &status);
+
+	if(!status) {
+		log[0] = 0;
+		gl.get_program_info_log(prog, sizeof log, log);
+		fprintf(stderr, "failed to link the shader program:\n%s\n", log);
+		gl.delete_program(prog);
+		return 0;
+	}
+	return prog;
+}
+
+void gls_use_program(unsigned int prog) {
+	if(program_known && prog == cur_program) {
+		FILTER(MTEXP_CALL_PROGRAM);
+		return;
+	}
+	/* nothing to unbind without shaders */
+	if(!gl.create_shader) return;
+
+	ISSUE(MTEXP_CALL_PROGRAM);
+	gl.use_program(prog);
+	cur_program = prog;
+	program_known = 1;
+}
+
+void gls_uniform_int(const char *name, int val) {
+	int loc = gl.get_uniform_location(cur_program, name);
+	if(loc != -1) gl.uniform1i(loc, val);
+}
+
+void gls_uniform_vec4(const char *name, const float *val) {
+	int loc = gl.get_uniform_location(cur_program, name);
+	if(loc != -1) gl.uniform4fv(loc, 1, val);
+}
+
+void gls_delete_program(unsigned int prog) {
+	if(!gl.create_shader) return;
+	gl.delete_program(prog);
+
+	/* the name may be handed out again */
+	if(prog == cur_program) program_known = 0;
+}
+
+GLenum gls_probe_target(unsigned int tex) {
+	const GLenum *tptr = gls_tex_type;
+
+	do {
+		gl.get_error();	/* clear errors */
+		gl.bind_texture(*tptr, tex);
+	} while(gl.get_error() != GL_NO_ERROR && *++tptr);
+
+	if(!*tptr) return GL_TEXTURE_2D;
+
+	if(cur_unit >= 0 && cur_unit < GLS_MAX_UNITS) {
+		int idx = gls_target_index(*tptr);
+		shadow[cur_unit].bound[idx] = tex;
+		shadow[cur_unit].bound_known[idx] = 1;
+	}
+	return *tptr;
+}
+
+/* --- gls_detect_caps() ---
+ * detection needs a current context. If there isn't one yet the
+ * extension string is null, and detection is retried on the next call.
+ */
+int gls_detect_caps(void) {
+	const char *ext, *ver;
+	int major = 0, minor = 0;
+
+	if(caps_known) return 0;
+
+	if(!gl.get_string || !(ext = gl.get_string(GL_EXTENSIONS))) {
+		return -1;
+	}
+	if((ver = gl.get_string(GL_VERSION)) && isdigit(*ver)) {
+		major = atoi(ver);
+		while(isdigit(*ver)) ver++;
+		if(*ver++ == '.') minor = atoi(ver);
+	}
+
+	caps = 0;
+	if(has_extension(ext, "GL_ATI_texture_env_combine3")) {
+		caps |= GLS_COMBINE3;
+	}
+	if(has_extension(ext, "GL_NV_texture_env_combine4")) {
+		caps |= GLS_COMBINE4;
+	}
+	if(has_extension(ext, "GL_ARB_texture_env_crossbar") || major > 1 || (major == 1 && minor >= 4)) {
+		caps |= GLS_CROSSBAR;
+	}
+	max_shader_units = 0;
+	if(major >= 2 && gl.create_shader) {
+		int coords = 0;
+
+		caps |= GLS_GLSL;
+		gl.get_integerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_shader_units);
+		gl.get_integerv(GL_MAX_TEXTURE_COORDS, &coords);
+		if(coords < max_shader_units) max_shader_units = coords;
+	}
+
+	max_units = 0;
+	gl.get_integerv(GL_MAX_TEXTURE_UNITS, &max_units);
+	if(max_units < 1 || max_units > GLS_MAX_UNITS) {
+		max_units = GLS_MAX_UNITS;
+	}
+	caps_known = 1;
+	return 0;
+}
+
+int gls_caps_known(void) {
+	return caps_known;
+}
+
+unsigned int gls_get_caps(void) {
+	return caps;
+}
+
+int gls_get_max_units(void) {
+	return max_units;
+}
+
+int gls_get_max_shader_units(void) {
+	return max_shader_units;
+}
+
+int gls_target_index(GLenum target) {
+	int i;
+	for(i=0; i<NUM_TEX_TYPES; i++) {
+		if(gls_tex_type[i] == target) return i;
+	}
+	return -1;
+}
+
+/* --- resize_temps() ---
+ * (re)allocates the temporaries, with power of two sizes for the sake of
+ * older implementations. The texture names stay the same, so that units
+ * bound to them don't need to know.
+ */
+static void resize_temps(int width, int height) {
+	int i;
+
+	temp_width = temp_height = 1;
+	while(temp_width < width) temp_width <<= 1;
+	while(temp_height < height) temp_height <<= 1;
+
+	gls_active_unit(0);
+	for(i=0; i<GLS_MAX_TEMPS; i++) {
+		gls_bind_texture(GL_TEXTURE_2D, gls_temp_texture(i));
+		gl.tex_image_2d(GL_TEXTURE_2D, 0, GL_RGBA8, temp_width, temp_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		gl.tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		gl.tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		gl.tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		gl.tex_parameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+}
+
+/* ---- public interface ---- */
+
+void mtexp_invalidate_state(void) {
+	gls_invalidate();
+}
+
+void mtexp_release_temps(void) {
+	if(temp_tex[0]) {
+		gl.delete_textures(GLS_MAX_TEMPS, temp_tex);
+		memset(temp_tex, 0, sizeof temp_tex);
+		temp_width = temp_height = 0;
+
+		/* the names may come back from glGenTextures as anything */
+		gls_invalidate();
+	}
+}
+
+void mtexp_set_gl(const struct mtexp_gl *table) {
+	if(table) {
+		gl = *table;
+	} else {
+		if(!gl_active_texture) {
+			gl_active_texture = (PFNGLACTIVETEXTUREARBPROC)get_proc_address("glActiveTextureARB");
+			gl_client_active_texture = (PFNGLCLIENTACTIVETEXTUREARBPROC)get_proc_address("glClientActiveTextureARB");
+		}
+		gl = def_gl;
+
+		if(!load_glsl()) {
+			gl.create_shader = 0;
+		}
+	}
+	caps = 0;
+	caps_known = 0;
+	max_units = GLS_MAX_UNITS;
+	max_shader_units = 0;
+
+	/* the temporaries belong to whatever was behind the old table */
+	memset(temp_tex, 0, sizeof temp_tex);
+	temp_width = temp_height = 0;
+	gls_invalidate();
+
+	gls_detect_caps();
+}
+
+void mtexp_get_stats(struct mtexp_stats *st) {
+	*st = stats;
+}
+
+void mtexp_reset_stats(void) {
+	memset(&stats, 0, sizeof stats);
+}
+
+static int env_index(GLenum pname) {
+	int i;
+	for(i=0; i<NUM_ENV_PARAMS; i++) {
+		if(env_param[i] == pname) return i;
+	}
+	return -1;
+}
+
+/* loads the GLSL entry points, returns 0 if any of them is missing */
+static int load_glsl(void) {
+	if(!gl_create_shader) {
+		gl_create_shader = (create_shader_proc)get_proc_address("glCreateShader");
+		gl_shader_source = (shader_source_proc)get_proc_address("glShaderSource");
+		gl_compile_shader = (object_proc)get_proc_address("glCompileShader");
+		gl_get_shaderiv = (get_objectiv_proc)get_proc_address("glGetShaderiv");
+		gl_get_shader_info_log = (get_info_log_proc)get_proc_address("glGetShaderInfoLog");
+		gl_delete_shader = (object_proc)get_proc_address("glDeleteShader");
+		gl_create_program = (create_program_proc)get_proc_address("glCreateProgram");
+		gl_attach_shader = (attach_shader_proc)get_proc_address("glAttachShader");
+		gl_link_program = (object_proc)get_proc_address("glLinkProgram");
+		gl_get_programiv = (get_objectiv_proc)get_proc_address("glGetProgramiv");
+		gl_get_program_info_log = (get_info_log_proc)get_proc_address("glGetProgramInfoLog");
+		gl_delete_program = (object_proc)get_proc_address("glDeleteProgram");
+		gl_use_program = (object_proc)get_proc_address("glUseProgram");
+		gl_get_uniform_location = (get_uniform_location_proc)get_proc_address("glGetUniformLocation");
+		gl_uniform1i = (uniform1i_proc)get_proc_address("glUniform1i");
+		gl_uniform4fv = (uniform4fv_proc)get_proc_address("glUniform4fv");
+	}
+
+	return gl_create_shader && gl_shader_source && gl_compile_shader && gl_get_shaderiv &&
+		gl_get_shader_info_log && gl_delete_shader && gl_create_program && gl_attach_shader &&
+		gl_link_program && gl_get_programiv && gl_get_program_info_log && gl_delete_program &&
+		gl_use_program && gl_get_uniform_location && gl_uniform1i && gl_uniform4fv;
+}
+
+/* looks for a whole word in the space separated extension string */
+static int has_extension(const char *ext_str, const char *name) {
+	const char *ptr = ext_str;
+	int len = strlen(name);
+
+	while((ptr = strstr(ptr, name))) {
+		if((ptr == ext_str || ptr[-1] == ' ') && (ptr[len] == ' ' || !ptr[len])) {
+			return 1;
+		}
+		ptr += len;
+	}
+	return 0;
+}
+
+static void def_active_texture(unsigned int unit) {
+	gl_active_texture(unit);
+}
+
+static void def_client_active_texture(unsigned int unit) {
+	gl_client_active_texture(unit);
+}
+
+static void def_tex_envi(unsigned int target, unsigned int pname, int val) {
+	glTexEnvi(target, pname, val);
+}
+
+static void def_tex_envfv(unsigned int target, unsigned int pname, const float *val) {
+	glTexEnvfv(target, pname, val);
+}
+
+static void def_bind_texture(unsigned int target, unsigned int tex) {
+	glBindTexture(target, tex);
+}
+
+static void def_enable(unsigned int cap) {
+	glEnable(cap);
+}
+
+static void def_disable(unsigned int cap) {
+	glDisable(cap);
+}
+
+static unsigned int def_get_error(void) {
+	return glGetError();
+}
+
+static const char *def_get_string(unsigned int name) {
+	return (const char*)glGetString(name);
+}
+
+static void def_get_integerv(unsigned int pname, int *val) {
+	glGetIntegerv(pname, val);
+}
+
+static void def_blend_func(unsigned int src, unsigned int dst) {
+	glBlendFunc(src, dst);
+}
+
+static void def_gen_textures(int n, unsigned int *tex) {
+	glGenTextures(n, tex);
+}
+
+static void def_delete_textures(int n, const unsigned int *tex) {
+	glDeleteTextures(n, tex);
+}
+
+static void def_tex_image_2d(unsigned int target, int level, int ifmt, int width, int height, int border, unsigned int fmt, unsigned int type, const void *pixels) {
+	glTexImage2D(target, level, ifmt, width, height, border, fmt, type, pixels);
+}
+
+static void def_tex_parameteri(unsigned int target, unsigned int pname, int val) {
+	glTexParameteri(target, pname, val);
+}
+
+static void def_copy_tex_sub_image_2d(unsigned int target, int level, int xoffs, int yoffs, int x, int y, int width, int height) {
+	glCopyTexSubImage2D(target, level, xoffs, yoffs, x, y, width, height);
+}
+
+static void def_tex_geni(unsigned int coord, unsigned int pname, int val) {
+	glTexGeni(coord, pname, val);
+}
+
+static void def_tex_genfv(unsigned int coord, unsigned int pname, const float *val) {
+	glTexGenfv(coord, pname, val);
+}
+
+static void def_matrix_mode(unsigned int mode) {
+	glMatrixMode(mode);
+}
+
+static void def_push_matrix(void) {
+	glPushMatrix();
+}
+
+static void def_pop_matrix(void) {
+	glPopMatrix();
+}
+
+static void def_load_matrixf(const float *mat) {
+	glLoadMatrixf(mat);
+}
+
+static void def_get_floatv(unsigned int pname, float *val) {
+	glGetFloatv(pname, val);
+}
+
+static void def_get_tex_level_parameteriv(unsigned int target, int level, unsigned int pname, int *val) {
+	glGetTexLevelParameteriv(target, level, pname, val);
+}
+
+static void def_get_tex_image(unsigned int target, int level, unsigned int fmt, unsigned int type, void *pixels) {
+	glGetTexImage(target, level, fmt, type, pixels);
+}
+
+static unsigned int def_create_shader(unsigned int type) {
+	return gl_create_shader(type);
+}
+
+static void def_shader_source(unsigned int sdr, const char *src) {
+	gl_shader_source(sdr, 1, &src, 0);
+}
+
+static void def_compile_shader(unsigned int sdr) {
+	gl_compile_shader(sdr);
+}
+
+static void def_get_shaderiv(unsigned int sdr, unsigned int pname, int *val) {
+	gl_get_shaderiv(sdr, pname, val);
+}
+
+static void def_get_shader_info_log(unsigned int sdr, int size, char *buf) {
+	gl_get_shader_info_log(sdr, size, 0, buf);
+}
+
+static void def_delete_shader(unsigned int sdr) {
+	gl_delete_shader(sdr);
+}
+
+static unsigned int def_create_program(void) {
+	return gl_create_program();
+}
+
+static void def_attach_shader(unsigned int prog, unsigned int sdr) {
+	gl_attach_shader(prog, sdr);
+}
+
+static void def_link_program(unsigned int prog) {
+	gl_link_program(prog);
+}
+
+static void def_get_programiv(unsigned int prog, unsigned int pname, int *val) {
+	gl_get_programiv(prog, pname, val);
+}
+
+static void def_get_program_info_log(unsigned int prog, int size, char *buf) {
+	gl_get_program_info_log(prog, size, 0, buf);
+}
+
+static void def_delete_program(unsigned int prog) {
+	gl_delete_program(prog);
+}
+
+static void def_use_program(unsigned int prog) {
+	gl_use_program(prog);
+}
+
+static int def_get_uniform_location(unsigned int prog, const char *name) {
+	return gl_get_uniform_location(prog, name);
+}
+
+static void def_uniform1i(int loc, int val) {
+	gl_uniform1i(loc, val);
+}
+
+static void def_uniform4fv(int loc, int count, const float *val) {
+	gl_uniform4fv(loc, count, val);
+}
@@ -0,0 +1,177 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _GLSTATE_H_
+#define _GLSTATE_H_
+
+#ifdef WIN32
+#include <windows.h>
+#endif	/* WIN32 */
+#include <GL/gl.h>
+#include "glext.h"
+
+/* OpenGL 2.0 enumerants, missing from older headers */
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER	0x8B30
+#define GL_COMPILE_STATUS	0x8B81
+#define GL_LINK_STATUS		0x8B82
+#endif
+#ifndef GL_MAX_TEXTURE_IMAGE_UNITS
+#define GL_MAX_TEXTURE_COORDS		0x8871
+#define GL_MAX_TEXTURE_IMAGE_UNITS	0x8872
+#endif
+
+/* Shadow copy of the texture environment state touched by libmtexp.
+ * All texture unit state changes go through these functions, which
+ * drop any call that wouldn't change the state as last set.
+ */
+
+/* number of texture units that are shadowed, state changes on units
+ * beyond that always reach OpenGL.
+ */
+#define GLS_MAX_UNITS	32
+
+/* number of render to texture temporaries in the pool */
+#define GLS_MAX_TEMPS	4
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* loads the required extension entry points and resets the shadow state */
+void gls_init(void);
+
+/* forgets everything known about the OpenGL state, must be called
+ * whenever someone else might have changed it.
+ */
+void gls_invalidate(void);
+
+void gls_active_unit(int unit);
+void gls_tex_envi(GLenum pname, GLint val);
+void gls_tex_envfv(GLenum pname, const GLfloat *val);
+void gls_bind_texture(GLenum target, unsigned int tex);
+void gls_enable(GLenum target);
+void gls_disable(GLenum target);
+
+/* enables framebuffer blending with the specified glBlendFunc factors,
+ * or disables it if src is 0.
+ */
+void gls_blend(GLenum src, GLenum dst);
+
+/* Render to texture temporaries: a pool of GL_TEXTURE_2D textures, large
+ * enough for the viewport, shared by all the states. The result of the
+ * passes rendering a temporary is copied from the framebuffer, and read
+ * back at the same pixels through texture coordinates generated from
+ * the window position.
+ */
+
+/* returns the texture object of a temporary, creating the pool first */
+unsigned int gls_temp_texture(int idx);
+
+/* copies the viewport of the framebuffer to a temporary, growing the
+ * pool if the viewport doesn't fit in it anymore. Uses unit 0.
+ */
+void gls_copy_temp(int idx);
+
+/* sets up the current unit to read a temporary at the pixel being drawn,
+ * with the current projection and viewport, or disables that again.
+ */
+void gls_screen_texgen(int enable);
+
+/* reads back the base level of a GL_TEXTURE_2D texture as RGBA bytes,
+ * in a buffer that must be freed. Uses unit 0. Returns null on error.
+ */
+unsigned char *gls_read_texture(unsigned int tex, int *width, int *height);
+
+/* specifies the image of a GL_TEXTURE_2D texture from RGBA bytes,
+ * creating the texture first if *tex is 0. Uses unit 0.
+ */
+void gls_upload_texture(unsigned int *tex, int width, int height, const unsigned char *pixels);
+
+/* deletes a texture created by gls_upload_texture */
+void gls_delete_texture(unsigned int tex);
+
+/* compiles a GLSL fragment shader and links it into a program on its
+ * own, printing the info log on failure. Returns 0 on error.
+ */
+unsigned int gls_link_shader(const char *src);
+
+/* makes a program current, 0 goes back to the fixed function pipeline */
+void gls_use_program(unsigned int prog);
+
+/* sets a uniform of the program made current with gls_use_program,
+ * uniforms the program doesn't use are ignored.
+ */
+void gls_uniform_int(const char *name, int val);
+void gls_uniform_vec4(const char *name, const float *val);
+
+void gls_delete_program(unsigned int prog);
+
+/* finds out the target of a texture by trial and error, leaves it bound
+ * to the current unit. Returns GL_TEXTURE_2D if nothing works.
+ */
+GLenum gls_probe_target(unsigned int tex);
+
+/* optional features of the OpenGL implementation */
+enum {
+	GLS_COMBINE3	= 1,	/* GL_ATI_texture_env_combine3 */
+	GLS_COMBINE4	= 2,	/* GL_NV_texture_env_combine4 */
+	GLS_CROSSBAR	= 4,	/* GL_ARB_texture_env_crossbar, or OpenGL 1.4 */
+	GLS_GLSL		= 8		/* OpenGL 2.0 fragment shaders */
+};
+
+/* finds out the features of the implementation behind the current
+ * dispatch table, once for every table. Returns -1 without a current
+ * context, in which case it's retried on the next call.
+ */
+int gls_detect_caps(void);
+
+/* non-zero once the features have been detected */
+int gls_caps_known(void);
+
+/* the optional features (GLS_* flags) detected, 0 until then. These
+ * and gls_get_max_units make no OpenGL calls, so they can be used on
+ * any thread once detection is done.
+ */
+unsigned int gls_get_caps(void);
+
+/* number of fixed function texture units (GL_MAX_TEXTURE_UNITS), or
+ * GLS_MAX_UNITS if it isn't known yet.
+ */
+int gls_get_max_units(void);
+
+/* number of textures a fragment shader can sample with coordinates of
+ * their own (the lower of GL_MAX_TEXTURE_IMAGE_UNITS and
+ * GL_MAX_TEXTURE_COORDS), 0 without GLSL support.
+ */
+int gls_get_max_shader_units(void);
+
+/* index of a texture target in gls_tex_type[], or -1 */
+int gls_target_index(GLenum target);
+
+/* all supported texture targets, zero terminated */
+extern const GLenum gls_tex_type[];
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _GLSTATE_H_ */
@@ -21,249 +21,1568 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
-#ifdef WIN32
-#include <windows.h>
-#endif	/* WIN32 */
-#include <GL/gl.h>
-#if defined(__unix__)
-#include <GL/glx.h>
-#endif
+#include <limits.h>
 #include "mtexp.h"
-#include "parser.h"
+#include "program.h"
+#include "optimize.h"
+#include "schedule.h"
+#include "passes.h"
+#include "bake.h"
+#include "glsl.h"
+#include "state.h"
 
+static unsigned int prog_flags(unsigned int caps, int alpha);
+static int build_program(const char *expr, unsigned int flags, int max_units,
+		struct pass_step *step, int max_steps, int *temp_base);
+static struct ptree *build_tree(const char *expr, unsigned int flags);
+static int schedule_tree(struct ptree *tree, unsigned int flags, int max_units,
+		struct pass_step *step, int max_steps, int *temp_base);
+static struct compiled *link_passes(struct pass_step *step, int passes, struct program *aprog,
+		int temp_base, unsigned int caps, int max_units);
+static struct compiled *make_compiled(const struct program *prog, const struct program *aprog,
+		unsigned int caps, int max_units);
+static int has_operator(const struct ptree *t, int symb);
+static int gen_glsl(const char *expr, unsigned int caps, struct glsl_code *code);
+static unsigned int make_shader(const struct glsl_code *code);
 
-#include "glext.h"
+/* OpenGL related functions */
+static int op_to_glcombine(int op);
+static int src_to_glsource(int src);
+static int op_sources(int op);
+static int setup_units(struct compiled *comp, const struct program *prog, const struct program *aprog, int *slot_unit);
+static int setup_alpha(struct compiled *comp, const struct program *prog, int *slot_unit);
+static int fit_alpha(const struct compiled *comp, const struct program *prog, int off);
+static int alpha_unit(struct compiled *comp, const struct program *prog, int i, int k, int *slot_unit);
+static void pass_unit(struct unit *u);
+static int pack_color(struct unit *u, const float *color, int part);
+static int bind_slots(struct compiled *comp, const struct program *prog, int *slot_unit);
+static int enable_shader(const struct mtexp *state);
+static void enable_unit(const struct mtexp *state, const struct compiled *pass, int i);
+static void disable_unit(const struct mtexp *state, const struct compiled *pass, int i);
+static int same_unit(const struct mtexp *a, const struct mtexp *b, int i);
+static int is_temp(const struct compiled *pass, int slot);
+static void set_comp(struct mtexp *ts, const struct compiled *comp);
+static void drop_bake(struct mtexp *state);
+static void make_sort_key(struct mtexp *ts);
+static int update_comp(const struct mtexp *state);
+static void set_shader(struct mtexp *ts);
+static unsigned int *base_key(struct mtexp *ts);
 
-PFNGLACTIVETEXTUREARBPROC gl_active_texture;
-PFNGLCLIENTACTIVETEXTUREARBPROC gl_client_active_texture;
+/* texture target registry */
+static GLenum lookup_target(unsigned int tex);
+static void resolve_targets(const struct mtexp *state);
 
-#if defined(__unix__)
-#define get_proc_address(s)	glXGetProcAddress(s)
-#elif defined(WIN32)
-#define get_proc_address(s)	wglGetProcAddress(s)
-#endif
 
+#ifdef DEBUG
+static int first_call;	/* for debugging purposes */
+#endif	/* DEBUG */
 
-static const GLenum tex_type[] = {
-	GL_TEXTURE_1D,
-	GL_TEXTURE_2D,
-	GL_TEXTURE_3D,
-	GL_TEXTURE_CUBE_MAP,
-	0
-};
+/* open addressing hash table of known texture targets */
+static struct tex_target {
+	unsigned int tex;
+	GLenum target;
+} *tex_reg;
+static int tex_reg_size, tex_reg_count;
 
-struct mtexp {
-	struct ptree *tree;
-	int passes;
-	unsigned int tex[MAX_TEXTURES];
-	int tex_count;
-	int active_tree;
 
-	int first_call;	/* for debugging purposes */
-};
+/* creates an mtexp state from the specified expression and texture ids */
+struct mtexp *mtexp_create(const char *expr, ...) {
+	va_list arg_list;
+	struct compiled *comp;
+	struct mtexp *ts;
 
-/* OpenGL related functions */
-static void init(void);
-static void active_unit(int unit);
-static int symbol_to_glcombine(int symb);
-static int symbol_to_glsource(struct symbol *s);
-static int handle_operand(struct symbol *symb, const unsigned int *tex);
-static int set_tex_state_rec(const struct ptree *t, const unsigned int *tex, int height);
+	if(!(comp = mtexp_compile_expr(expr))) {
+		return 0;
+	}
 
-/* additional parse tree operations */
-static int height(struct ptree *t);
-static int count_ops(struct ptree *t);
-static int is_symb_texture(int s);
-static int count_tex_usage(struct ptree *t);
+	va_start(arg_list, expr);
+	ts = mtexp_create_state(comp, 1, arg_list);
+	va_end(arg_list);
 
+	if(!ts) mtexp_free_compiled(comp);
+	return ts;
+}
 
-static int first_call = -1;	/* not only for debugging purposes */
+void mtexp_free(struct mtexp *state) {
+	drop_bake(state);
+	if(state->own_comp) {
+		mtexp_free_compiled((struct compiled*)state->comp);
+	}
+	free(state->key_buf);
+	free(state);
+}
 
+int mtexp_init(void) {
+	gls_init();
+	return gls_caps_known() ? 0 : -1;
+}
 
-/* creates an mtexp state from the specified expression and texture ids */
-struct mtexp *mtexp_create(const char *expr, ...) {
-	va_list arg_list;
+int mtexp_enable(const struct mtexp *state) {
+	return mtexp_enable_pass(state, 0);
+}
+
+int mtexp_get_passes(const struct mtexp *state) {
+	return state->passes;
+}
+
+/* --- mtexp_enable_pass() ---
+ * Each pass sets up all of its units, and disables the ones only the
+ * other passes use. The shadow state filters out whatever is already set,
+ * so going through the passes in order only costs their differences.
+ * The first pass after the ones rendering a temporary copies it from the
+ * framebuffer, before anything gets drawn over it.
+ */
+int mtexp_enable_pass(const struct mtexp *state, int pass) {
+	static const GLenum blend_src[] = {0, GL_ONE, GL_DST_COLOR};
+	static const GLenum blend_dst[] = {0, GL_ONE, GL_ZERO};
+	const struct compiled *comp = state->comp, *prev = 0, *other;
 	int i;
-	struct mtexp *ts;
 
-	if(first_call == -1) {
-		first_call = 0;
-		init();
+	if(update_comp(state) == -1) return -1;
+	comp = state->comp;
+	resolve_targets(state);
+
+	if(pass < 0 || pass >= state->passes) return -1;
+
+	if(state->shader && enable_shader(state) != -1) {
+		return 0;
 	}
 
-	ts = malloc(sizeof(struct mtexp));
-	ts->first_call = 1;
+	if(state->bake && state->bake->stale) {
+		mtexp_bake(state->bake);
+	}
+
+	for(i=0; i<pass; i++) {
+		prev = comp;
+		comp = comp->next_pass;
+	}
 
-	ts->tree = mtexp_parse(expr);
-	mtexp_show_ptree(ts->tree);
+	if(prev && prev->temp >= 0 && comp->temp != prev->temp) {
+		gls_copy_temp(prev->temp);
+	}
 
-	if(height(ts->tree) != count_ops(ts->tree) + 1) {
-		fprintf(stderr, "invalid texture state tree (ops: %d, height: %d)\n", count_ops(ts->tree), height(ts->tree));
-		mtexp_free(ts);
+#ifdef DEBUG
+	first_call = state->first_call;
+	if(state->first_call) ((struct mtexp*)state)->first_call = 0;
+#endif	/* DEBUG */
+
+	if(state->passes > 1) {
+		for(other=state->comp; other; other=other->next_pass) {
+			if(other == comp) continue;
+
+			for(i=other->unit_count-1; i>=0; i--) {
+				int otex = other->unit[i].tex;
+
+				if(i < comp->unit_count) {
+					int tex = comp->unit[i].tex;
+
+					/* a texture of a different target must be disabled
+					 * explicitly, and so must the texgen of temporaries.
+					 */
+					if(otex < 0 || (tex >= 0 && state->target[otex] &&
+								state->target[otex] == state->target[tex] &&
+								is_temp(other, otex) == is_temp(comp, tex))) {
+						continue;
+					}
+				}
+				disable_unit(state, other, i);
+			}
+		}
+	}
+
+	for(i=0; i<comp->unit_count; i++) {
+		enable_unit(state, comp, i);
+	}
+
+	if(state->passes > 1) {
+		gls_blend(blend_src[comp->blend], blend_dst[comp->blend]);
+	}
+	return 0;
+}
+
+void mtexp_disable(const struct mtexp *state) {
+	int i;
+	const struct compiled *comp;
+
+	/* the textures stay bound, but nothing is enabled */
+	if(state->shader) {
+		gls_use_program(0);
+		gls_active_unit(0);
+		return;
+	}
+
+	for(comp=state->comp; comp; comp=comp->next_pass) {
+		for(i=comp->unit_count-1; i>=0; i--) {
+			disable_unit(state, comp, i);
+		}
+	}
+	if(state->passes > 1) {
+		gls_blend(0, 0);
+	}
+}
+
+int mtexp_switch(const struct mtexp *from, const struct mtexp *to) {
+	int i, from_units, to_units;
+
+	if(!from) return to ? mtexp_enable(to) : 0;
+	if(!to) {
+		mtexp_disable(from);
 		return 0;
 	}
+	if(from == to) return 0;
 
-	ts->tex_count = count_tex_usage(ts->tree);
-	printf("textures in tree: %d\n", ts->tex_count);
+	if(update_comp(to) != 0) {
+		mtexp_disable(from);
+		return mtexp_enable(to);
+	}
+	resolve_targets(to);
 
-	va_start(arg_list, expr);
+	/* a shader replaces the other one along with all of its textures */
+	if(from->shader && to->shader) {
+		return mtexp_enable(to);
+	}
 
-	for(i=0; i<ts->tex_count; i++) {
-		ts->tex[i] = va_arg(arg_list, unsigned int);
+	/* any pass of a multipass state might be the one enabled, and baking
+	 * rebinds textures behind the units of the other state.
+	 */
+	if(from->passes > 1 || to->passes > 1 || (to->bake && to->bake->stale) ||
+			from->shader || to->shader) {
+		mtexp_disable(from);
+		return mtexp_enable(to);
 	}
 
-	va_end(arg_list);
+	from_units = from->comp->unit_count;
+	to_units = to->comp->unit_count;
 
-	return ts;
+	/* units the incoming state doesn't use anymore */
+	for(i=from_units-1; i>=to_units; i--) {
+		disable_unit(from, from->comp, i);
+	}
+
+	for(i=0; i<to_units; i++) {
+		if(i < from_units) {
+			int ftex = from->comp->unit[i].tex;
+			int ttex = to->comp->unit[i].tex;
+
+			if(same_unit(from, to, i)) continue;
+
+			/* a texture of a different target must be disabled explicitly */
+			if(ftex >= 0 && (ttex < 0 || from->target[ftex] != to->target[ttex])) {
+				disable_unit(from, from->comp, i);
+			}
+		}
+		enable_unit(to, to->comp, i);
+	}
+	return 0;
 }
 
-void mtexp_free(struct mtexp *state) {
-	mtexp_free_ptree(state->tree);
-	free(state);
+int mtexp_get_schedule(const struct mtexp *state, struct mtexp_unit_info *info, int max) {
+	int i, j;
+
+	/* the shader reads tN on unit N, and leaves the combiners alone */
+	if(state->shader) {
+		for(i=0; info && i<max && i<state->tex_count; i++) {
+			memset(info + i, 0, sizeof *info);
+			info[i].slot = i;
+			info[i].tex = state->tex[i];
+		}
+		return state->tex_count;
+	}
+
+	for(i=0; info && i<max && i<state->comp->unit_count; i++) {
+		const struct unit *u = state->comp->unit + i;
+
+		info[i].slot = u->tex;
+		info[i].tex = u->tex >= 0 ? state->tex[u->tex] : 0;
+		info[i].mode = u->mode;
+		info[i].combine = u->op;
+		for(j=0; j<3; j++) {
+			info[i].src[j] = u->src[j];
+		}
+		info[i].src_count = u->src_count;
+		info[i].scale = u->scale;
+		info[i].alpha_combine = u->alpha_op;
+		for(j=0; j<3; j++) {
+			info[i].alpha_src[j] = u->alpha_src[j];
+		}
+		info[i].alpha_src_count = u->alpha_src_count;
+		info[i].alpha_scale = u->alpha_scale;
+		info[i].has_color = u->has_color;
+		memcpy(info[i].color, u->color, sizeof info[i].color);
+	}
+	return state->comp->unit_count;
 }
 
-int mtexp_enable(const struct mtexp *state) {
+int mtexp_state_cmp(const struct mtexp *a, const struct mtexp *b) {
+	int i, part, na, nb, n;
+
+	/* multipass states set everything up again for each pass anyway */
+	if(a->passes != b->passes) {
+		return a->passes - b->passes;
+	}
+
+	/* states running the same shader first, then by their textures */
+	if(a->shader != b->shader) {
+		return a->shader - b->shader;
+	}
+	if(a->shader) {
+		/* states share the compiled expression, and its shader */
+		if(a->comp != b->comp) {
+			return a->comp < b->comp ? -1 : 1;
+		}
+		for(i=0; i<a->tex_count && i<b->tex_count; i++) {
+			if(a->tex[i] != b->tex[i]) return a->tex[i] < b->tex[i] ? -1 : 1;
+		}
+		return a->tex_count - b->tex_count;
+	}
+
+	na = a->comp->unit_count;
+	nb = b->comp->unit_count;
+	n = na > nb ? na : nb;
+
+	/* compare the texture part of the keys first, then the combiner part */
+	for(part=0; part<2; part++) {
+		const unsigned int *pa = a->key + part * na;
+		const unsigned int *pb = b->key + part * nb;
+
+		for(i=0; i<n; i++) {
+			unsigned int ka = i < na ? pa[i] : 0;
+			unsigned int kb = i < nb ? pb[i] : 0;
+
+			if(ka != kb) return ka < kb ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+/* --- mtexp_compile_expr() ---
+ * parses and compiles an expression to a unit table which refers to
+ * textures by slot, so it can be shared by any number of states. An
+ * optional alpha expression follows the color one after a semicolon,
+ * and runs on the alpha combiners of the same units. Color expressions
+ * which need more units than there are get split into passes, each with
+ * a unit table of its own, possibly rendering temporaries read by the
+ * later ones.
+ */
+struct compiled *mtexp_compile_expr(const char *expr) {
+	struct pass_step step[MAX_PASSES], astep;
+	struct program *aprog = 0;
+	struct compiled *comp;
+	const char *alpha_expr = strchr(expr, ';');
+	char *rgb_expr;
+	int passes, temp_base, atemp_base;
+	unsigned int caps = mtexp_get_caps(), flags = prog_flags(caps, alpha_expr != 0);
+	int max_units = gls_get_max_units();
+
+	if(!alpha_expr) {
+		if(!(passes = build_program(expr, flags, max_units, step, MAX_PASSES, &temp_base))) {
+			return 0;
+		}
+	} else {
+		if(!(rgb_expr = malloc(alpha_expr - expr + 1))) {
+			return 0;
+		}
+		memcpy(rgb_expr, expr, alpha_expr - expr);
+		rgb_expr[alpha_expr - expr] = 0;
+
+		/* blending would mix up the alpha of the passes, so both parts
+		 * have to fit in a single one.
+		 */
+		passes = build_program(rgb_expr, flags, max_units, step, 1, &temp_base);
+		free(rgb_expr);
+		if(!passes) return 0;
+
+		if(!build_program(alpha_expr + 1, flags | PROG_ALPHA, max_units, &astep, 1, &atemp_base)) {
+			mtexp_free_program(step[0].prog);
+			return 0;
+		}
+		aprog = astep.prog;
+	}
+
+	if(!(comp = link_passes(step, passes, aprog, temp_base, caps, max_units))) {
+		return 0;
+	}
+
+	/* kept for baking, which compiles the expression again */
+	if(!(comp->expr = malloc(strlen(expr) + 1))) {
+		mtexp_free_compiled(comp);
+		return 0;
+	}
+	strcpy(comp->expr, expr);
+
+	/* the units stay around for states that can't run the shader, or
+	 * expressions with more textures than a shader can read.
+	 */
+	if((caps & GLS_GLSL) && (comp->glsl = malloc(sizeof *comp->glsl))) {
+		if(gen_glsl(expr, caps, comp->glsl) == -1) {
+			free(comp->glsl);
+			comp->glsl = 0;
+		} else if(comp->glsl->tex_count > gls_get_max_shader_units()) {
+			mtexp_glsl_free(comp->glsl);
+			free(comp->glsl);
+			comp->glsl = 0;
+		}
+	}
+
 #ifdef DEBUG
-	first_call = state->first_call;
-	if(state->first_call) ((struct mtexp*)state)->first_call = 0;
+	printf("textures in tree: %d, passes: %d\n", comp->tex_count, passes);
 #endif	/* DEBUG */
+	return comp;
+}
 
-	return set_tex_state_rec(state->tree, state->tex, height(state->tree) - 2);
+unsigned int mtexp_get_caps(void) {
+	return gls_get_caps();
 }
 
-void mtexp_disable(const struct mtexp *state) {
-	int i;
-	for(i=state->tex_count-1; i>=0; i--) {
-		const GLenum *tptr = tex_type;
-		active_unit(i);
-		while(*tptr) glDisable(*tptr++);
+void mtexp_free_compiled(struct compiled *comp) {
+	while(comp) {
+		struct compiled *next = comp->next_pass;
+		if(comp->shader) gls_delete_program(comp->shader);
+		if(comp->glsl) {
+			mtexp_glsl_free(comp->glsl);
+			free(comp->glsl);
+		}
+		free(comp->expr);
+		free(comp);
+		comp = next;
+	}
+}
+
+struct mtexp *mtexp_create_state(const struct compiled *comp, int own, va_list ap) {
+	int i, slots;
+	struct mtexp *ts;
+
+	/* the slots of the expression, a baked one and the temporaries */
+	slots = comp->tex_count + 1 + MAX_TEMPS;
+
+	if(!(ts = malloc(sizeof *ts + (2 * comp->unit_count + slots) * sizeof *ts->key +
+					slots * sizeof *ts->target))) {
+		return 0;
+	}
+	ts->key = (unsigned int*)(ts + 1);
+	ts->key_buf = 0;
+	ts->key_units = comp->unit_count;
+	ts->tex = ts->key + 2 * comp->unit_count;
+	ts->target = (GLenum*)(ts->tex + slots);
+	ts->slot_count = slots;
+	ts->own_comp = own;
+	ts->bake = 0;
+	ts->first_call = 1;
+	set_comp(ts, comp);
+
+	/* textures that aren't registered yet get resolved on first use */
+	for(i=0; i<ts->tex_count; i++) {
+		ts->tex[i] = va_arg(ap, unsigned int);
+		ts->target[i] = lookup_target(ts->tex[i]);
+	}
+
+	set_shader(ts);
+	make_sort_key(ts);
+	return ts;
+}
+
+/* --- mtexp_set_dynamic() ---
+ * The expression is parsed again, and the static subtree replaced by a
+ * new texture slot after the ones of the state. The rest is compiled for
+ * the state alone, the subtree is kept around for baking it again.
+ */
+int mtexp_set_dynamic(struct mtexp *state, unsigned int dynamic) {
+	struct pass_step step[MAX_PASSES];
+	struct ptree *tree, *root, **link;
+	struct compiled *comp;
+	struct bake *bake;
+	unsigned int caps, flags;
+	int i, passes, temp_base, max_units;
+	const char *expr;
+
+	drop_bake(state);
+
+	/* baking runs on the thread of the context, which can find out the
+	 * features if they aren't known yet.
+	 */
+	if(update_comp(state) == -1) return -1;
+	caps = mtexp_get_caps();
+	flags = prog_flags(caps, 0);
+	max_units = gls_get_max_units();
+
+	/* the shader runs in a single pass anyway */
+	if(state->shader) return -1;
+
+	/* the alpha part would need baking of its own */
+	if(!(expr = state->comp->expr) || strchr(expr, ';')) {
+		return -1;
+	}
+
+	/* only 2D textures can be baked */
+	resolve_targets(state);
+	for(i=0; i<state->tex_count; i++) {
+		if(state->target[i] != GL_TEXTURE_2D && i < 32) dynamic |= 1u << i;
+	}
+
+	if(!(root = tree = build_tree(expr, flags))) {
+		return -1;
+	}
+	if(!(link = mtexp_find_static(&root, dynamic)) || !(bake = malloc(sizeof *bake))) {
+		mtexp_free_ptree(tree);
+		return -1;
+	}
+	bake->tree = tree;
+	bake->sub = *link;
+	if(!(bake->prog = mtexp_compile(bake->sub, flags))) {
+		mtexp_free_ptree(tree);
+		free(bake);
+		return -1;
+	}
+	bake->slot = state->tex_count;
+	bake->slots = mtexp_tree_slots(bake->sub);
+	bake->tex = 0;
+	bake->stale = 1;
+	bake->state = state;
+	bake->orig_comp = state->comp;
+	bake->orig_own = state->own_comp;
+	bake->key = 0;
+
+	bake->leaf.symb.symb = SYMB_T0 + bake->slot;
+	bake->leaf.symb.type = SYMB_TYPE_ARG;
+	bake->leaf.symb.str = "baked";
+	bake->leaf.left = bake->leaf.right = 0;
+	*link = &bake->leaf;
+
+	if(!(passes = schedule_tree(root, flags, max_units, step, MAX_PASSES, &temp_base)) ||
+			!(comp = link_passes(step, passes, 0, temp_base, caps, max_units))) {
+		mtexp_free_program(bake->prog);
+		mtexp_free_ptree(tree);
+		free(bake);
+		return -1;
+	}
+	bake->comp = comp;
+
+	/* the sort key is allocated along with the state, for its own units */
+	if(comp->unit_count > state->comp->unit_count) {
+		if(!(bake->key = malloc(2 * comp->unit_count * sizeof *bake->key))) {
+			mtexp_free_compiled(comp);
+			mtexp_free_program(bake->prog);
+			mtexp_free_ptree(tree);
+			free(bake);
+			return -1;
+		}
+		state->key = bake->key;
 	}
+
+	if(mtexp_bake(bake) == -1) {
+		state->key = base_key(state);
+		free(bake->key);
+		mtexp_free_compiled(comp);
+		mtexp_free_program(bake->prog);
+		mtexp_free_ptree(tree);
+		if(bake->tex) gls_delete_texture(bake->tex);
+		free(bake);
+		return -1;
+	}
+	mtexp_bake_add(bake);
+
+	state->bake = bake;
+	state->own_comp = 0;
+	set_comp(state, comp);
+	state->tex[bake->slot] = bake->tex;
+	state->target[bake->slot] = GL_TEXTURE_2D;
+	make_sort_key(state);
+	return 0;
+}
+
+int mtexp_texture_target(unsigned int tex, unsigned int target) {
+	unsigned int i;
+
+	if(!target) return -1;
+
+	if(tex_reg_count >= tex_reg_size * 3 / 4) {
+		/* grow the table and rehash everything */
+		struct tex_target *old = tex_reg;
+		int j, old_size = tex_reg_size;
+		int new_size = old_size ? old_size * 2 : 64;
+
+		if(!(tex_reg = calloc(new_size, sizeof *tex_reg))) {
+			tex_reg = old;
+			return -1;
+		}
+		tex_reg_size = new_size;
+		tex_reg_count = 0;
+
+		for(j=0; j<old_size; j++) {
+			if(old[j].target) mtexp_texture_target(old[j].tex, old[j].target);
+		}
+		free(old);
+	}
+
+	i = tex % tex_reg_size;
+	while(tex_reg[i].target && tex_reg[i].tex != tex) {
+		i = (i + 1) % tex_reg_size;
+	}
+	if(!tex_reg[i].target) tex_reg_count++;
+
+	tex_reg[i].tex = tex;
+	tex_reg[i].target = target;
+	return 0;
+}
+
+char *mtexp_glsl_source(const char *expr) {
+	struct glsl_code code;
+
+	if(gen_glsl(expr, mtexp_get_caps(), &code) == -1) {
+		return 0;
+	}
+	free(code.consts);
+	return code.src;
 }
 
 /* ---------- local functions ----------- */
 
-static void init(void) {
-	gl_active_texture = get_proc_address("glActiveTextureARB");
-	gl_client_active_texture = get_proc_address("glClientActiveTextureARB");
+/* PROG_* flags for the features of the implementation */
+static unsigned int prog_flags(unsigned int caps, int alpha) {
+	unsigned int flags = 0;
+
+	if(caps & GLS_COMBINE3) {
+		flags |= PROG_MODULATE_ADD;
+	}
+	if(caps & GLS_CROSSBAR) {
+		flags |= PROG_CROSSBAR;
+	}
+
+	/* GL_COMBINE4_NV changes the alpha combiner too, so it's only used
+	 * when there is no alpha expression.
+	 */
+	if((caps & GLS_COMBINE4) && !alpha) {
+		flags |= PROG_MODULATE_ADD;
+	}
+	return flags;
+}
+
+/* --- build_program() ---
+ * parses, optimizes and schedules a single (color or alpha) expression,
+ * in up to max_steps passes. Returns the number of passes, or 0 on error.
+ */
+static int build_program(const char *expr, unsigned int flags, int max_units,
+		struct pass_step *step, int max_steps, int *temp_base) {
+	struct ptree *tree;
+	int passes;
+
+	if(!(tree = build_tree(expr, flags))) {
+		return 0;
+	}
+
+	/* lower the tree to flat programs, the tree isn't needed after that */
+	passes = schedule_tree(tree, flags, max_units, step, max_steps, temp_base);
+	mtexp_free_ptree(tree);
+	return passes;
+}
+
+/* parses and optimizes an expression, returns null on error */
+static struct ptree *build_tree(const char *expr, unsigned int flags) {
+	struct ptree *tree;
+	struct parse_ctx pctx;	/* per-call, so that creation is reentrant */
+	int removed;
+
+	if(!(tree = mtexp_parse_r(expr, &pctx))) {
+		return 0;
+	}
+	if((flags & PROG_ALPHA) && has_operator(tree, SYMB_DOT)) {
+		fprintf(stderr, "the dot product can't be used in alpha expressions\n");
+		mtexp_free_ptree(tree);
+		return 0;
+	}
+
+	mtexp_fold_constants(tree, flags);
+	if((removed = mtexp_eliminate_common(tree)) > 0) {
+#ifdef DEBUG
+		printf("common subexpressions removed %d operators\n", removed);
+#endif	/* DEBUG */
+		mtexp_fold_constants(tree, flags);	/* x - x leaves zeros behind */
+	}
+	mtexp_reassociate(tree);
+#ifdef DEBUG
+	mtexp_show_ptree(tree);
+#endif	/* DEBUG */
+	return tree;
+}
+
+/* schedules an optimized tree in passes, reporting why it can't be */
+static int schedule_tree(struct ptree *tree, unsigned int flags, int max_units,
+		struct pass_step *step, int max_steps, int *temp_base) {
+	struct sched_cost cost;
+	int passes;
+
+	passes = mtexp_plan_passes(tree, flags, max_units, step, max_steps, temp_base, &cost);
+
+#ifdef DEBUG
+	printf("schedule: %d units, %d colors, %d fetches, %d passes\n", cost.units, cost.colors, cost.fetches, passes);
+#endif	/* DEBUG */
+
+	if(!passes) {
+		if(cost.units > max_units) {
+			fprintf(stderr, "expression needs %d texture units, only %d available\n", cost.units, max_units);
+		} else {
+			fprintf(stderr, "invalid texture state tree (not a single chain of operations)\n");
+		}
+	}
+	return passes;
 }
 
-/* sets the active texture unit */
-static void active_unit(int unit) {
-	gl_active_texture((GLenum)((int)GL_TEXTURE0 + unit));
-	gl_client_active_texture((GLenum)((int)GL_TEXTURE0 + unit));
+/* --- link_passes() ---
+ * builds the unit tables of the passes, linked from the first one, and
+ * frees the programs. Returns null on error.
+ */
+static struct compiled *link_passes(struct pass_step *step, int passes, struct program *aprog,
+		int temp_base, unsigned int caps, int max_units) {
+	struct compiled *comp = 0, *tail = 0, *pass;
+	int i, temps = 0, failed = 0;
+
+	for(i=0; i<passes; i++) {
+		if(step[i].temp >= 0) temps = 1;
+	}
+
+	for(i=0; i<passes; i++) {
+		if(!failed) {
+			if(!(pass = make_compiled(step[i].prog, i ? 0 : aprog, caps, max_units))) {
+				failed = 1;
+			} else {
+				pass->blend = step[i].blend;
+				pass->pass_count = passes;
+				pass->temp = step[i].temp;
+				pass->temp_base = temps ? temp_base : INT_MAX;
+
+				if(!comp) {
+					comp = pass;
+				} else {
+					tail->next_pass = pass;
+
+					/* the first pass holds the texture slots of all of them */
+					if(pass->tex_count > comp->tex_count) {
+						comp->tex_count = pass->tex_count;
+					}
+				}
+				tail = pass;
+			}
+		}
+		mtexp_free_program(step[i].prog);
+	}
+	if(aprog) mtexp_free_program(aprog);
+
+	if(failed) {
+		if(comp) mtexp_free_compiled(comp);
+		return 0;
+	}
+	/* the temporaries aren't arguments of the states */
+	if(temps) comp->tex_count = temp_base;
+	return comp;
 }
 
-static int symbol_to_glcombine(int symb) {
-	static int map[] = {GL_ADD, GL_SUBTRACT, GL_MODULATE, GL_DOT3_RGB};
-	return map[symb];
+static int has_operator(const struct ptree *t, int symb) {
+	if(!t || t->symb.type != SYMB_TYPE_OP) return 0;
+	if(t->symb.symb == symb) return 1;
+	return has_operator(t->left, symb) || has_operator(t->right, symb);
 }
 
-static int symbol_to_glsource(struct symbol *s) {
+/* --- gen_glsl() ---
+ * generates the shader of an expression from the same programs, fused
+ * for the same combiner features, the units would run. Returns -1 on
+ * error.
+ */
+static int gen_glsl(const char *expr, unsigned int caps, struct glsl_code *code) {
+	struct ptree *tree;
+	struct program *rgb, *alpha = 0;
+	const char *alpha_expr = strchr(expr, ';');
+	char *rgb_expr;
+	unsigned int flags = prog_flags(caps, alpha_expr != 0);
 	int res;
 
-	if(s->type == SYMB_TYPE_ARG) {
-		switch(s->symb) {
-		case SYMB_COL:
-			res = GL_PRIMARY_COLOR;
-			break;
+	if(!(rgb_expr = malloc(strlen(expr) + 1))) {
+		return -1;
+	}
+	strcpy(rgb_expr, expr);
+	if(alpha_expr) rgb_expr[alpha_expr - expr] = 0;
+
+	tree = build_tree(rgb_expr, flags);
+	free(rgb_expr);
+	if(!tree) return -1;
+	rgb = mtexp_compile(tree, flags);
+	mtexp_free_ptree(tree);
+	if(!rgb) return -1;
+
+	if(alpha_expr) {
+		if(!(tree = build_tree(alpha_expr + 1, flags | PROG_ALPHA))) {
+			mtexp_free_program(rgb);
+			return -1;
+		}
+		alpha = mtexp_compile(tree, flags | PROG_ALPHA);
+		mtexp_free_ptree(tree);
+		if(!alpha) {
+			mtexp_free_program(rgb);
+			return -1;
+		}
+	}
+
+	res = mtexp_glsl_gen(code, rgb, alpha);
+
+	mtexp_free_program(rgb);
+	if(alpha) mtexp_free_program(alpha);
+	return res;
+}
+
+/* --- make_shader() ---
+ * links a generated shader, and sets its uniforms for good: tN samples
+ * unit N, and the constants never change. The program is left current.
+ * Returns 0 on error.
+ */
+static unsigned int make_shader(const struct glsl_code *code) {
+	unsigned int prog;
+	char name[32];
+	int i;
+
+	if((prog = gls_link_shader(code->src))) {
+		gls_use_program(prog);
+		for(i=0; i<code->tex_count; i++) {
+			sprintf(name, "t%d", i);
+			gls_uniform_int(name, i);
+		}
+		for(i=0; i<code->const_count; i++) {
+			sprintf(name, "k%d", i);
+			gls_uniform_vec4(name, code->consts[i]);
+		}
+	}
+	return prog;
+}
 
-		case SYMB_NUM:
-			res = GL_CONSTANT;
+/* builds the unit table of a single pass, returns null on error */
+static struct compiled *make_compiled(const struct program *prog, const struct program *aprog,
+		unsigned int caps, int max_units) {
+	struct compiled *comp;
+	int i, units, slots, res, *slot_unit, crossbar = prog->flags & PROG_CROSSBAR;
+
+	/* with the crossbar, textures may need units of their own, and the
+	 * alpha program may need units after the color ones.
+	 */
+	units = prog->count + (crossbar ? prog->tex_count : 0);
+	if(aprog) {
+		units += aprog->count + (crossbar ? aprog->tex_count : 0);
+	}
+
+	/* unit each texture slot is bound to, with the crossbar */
+	slots = prog->tex_count;
+	if(aprog && aprog->tex_count > slots) slots = aprog->tex_count;
+
+	if(!(slot_unit = malloc((slots + 1) * sizeof *slot_unit))) {
+		return 0;
+	}
+	for(i=0; i<slots; i++) {
+		slot_unit[i] = -1;
+	}
+
+	if(!(comp = malloc(sizeof *comp + units * sizeof *comp->unit))) {
+		free(slot_unit);
+		return 0;
+	}
+	comp->unit = (struct unit*)(comp + 1);
+	comp->caps = caps;
+	comp->max_units = max_units;
+	comp->blend = PASS_REPLACE;
+	comp->pass_count = 1;
+	comp->next_pass = 0;
+	comp->temp = -1;
+	comp->temp_base = INT_MAX;
+	comp->expr = 0;
+	comp->glsl = 0;
+	comp->shader = 0;
+	comp->shader_linked = 0;
+
+	/* resolve the programs into the per-unit state table */
+	res = setup_units(comp, prog, aprog, slot_unit);
+	free(slot_unit);
+
+	if(res == -1) {
+		fprintf(stderr, "can't fit the constants of the expression to the texture units\n");
+	} else if(comp->unit_count > max_units) {
+		fprintf(stderr, "expression needs %d texture units, only %d available\n", comp->unit_count, max_units);
+		res = -1;
+	}
+
+	if(res == -1) {
+		free(comp);
+		return 0;
+	}
+	return comp;
+}
+
+static int op_to_glcombine(int op) {
+	static int map[] = {
+		GL_ADD, GL_SUBTRACT, GL_MODULATE, GL_DOT3_RGB, GL_REPLACE,
+		GL_INTERPOLATE, GL_ADD_SIGNED, GL_MODULATE_ADD_ATI, GL_MODULATE_SIGNED_ADD_ATI
+	};
+	return map[op];
+}
+
+static int src_to_glsource(int src) {
+	static int map[] = {GL_PREVIOUS, GL_PRIMARY_COLOR, GL_CONSTANT, GL_TEXTURE};
+	return map[src];
+}
+
+/* number of sources the combine function of an instruction reads */
+static int op_sources(int op) {
+	switch(op) {
+	case OP_INTERPOLATE:
+	case OP_MODULATE_ADD:
+	case OP_MODULATE_SIGNED_ADD:
+		return 3;
+
+	default:
+		break;
+	}
+	return 2;
+}
+
+/* --- setup_units() ---
+ * resolves every instruction of the color program, and of the alpha
+ * program if there is one, to the complete state of the texture unit it
+ * runs on, so that enabling doesn't have to decode anything. Returns -1
+ * if the constants of a unit can't be packed into its constant color.
+ */
+static int setup_units(struct compiled *comp, const struct program *prog, const struct program *aprog, int *slot_unit) {
+	int i, j;
+	int crossbar = prog->flags & PROG_CROSSBAR;
+
+	comp->tex_count = prog->tex_count;
+	comp->has_alpha = aprog != 0;
+	comp->unit_count = crossbar ? bind_slots(comp, prog, slot_unit) : prog->count;
+
+	for(i=0; i<prog->count; i++) {
+		const struct instr *in = prog->code + i;
+		struct unit *u = comp->unit + i;
+
+		if(!crossbar) u->tex = -1;
+		u->has_color = 0;
+		u->op = op_to_glcombine(in->op);
+		u->scale = in->scale;
+
+		for(j=0; j<MAX_SOURCES; j++) {
+			u->src[j] = src_to_glsource(in->src[j]);
+
+			if(in->src[j] == SRC_TEX) {
+				if(!crossbar) {
+					u->tex = in->arg[j];
+				} else if(slot_unit[in->arg[j]] != i) {
+					/* bound to another unit */
+					u->src[j] = GL_TEXTURE0 + slot_unit[in->arg[j]];
+				}
+			} else if(in->src[j] == SRC_CONST) {
+				if(pack_color(u, prog->consts[in->arg[j]], COLOR_RGB) == -1) return -1;
+			}
+		}
+
+		u->mode = GL_COMBINE;
+		u->src_count = op_sources(in->op);
+
+		/* without an alpha expression, alpha is left to the defaults */
+		u->alpha_op = GL_MODULATE;
+		u->alpha_src[0] = GL_TEXTURE;
+		u->alpha_src[1] = GL_PREVIOUS;
+		u->alpha_src[2] = GL_CONSTANT;
+		u->alpha_src_count = 2;
+		u->alpha_scale = 1;
+
+		switch(in->op) {
+		case OP_MODULATE_ADD:
+		case OP_MODULATE_SIGNED_ADD:
+			if(comp->caps & GLS_COMBINE3) {
+				/* ATI computes src0 * src2 + src1 */
+				GLenum tmp = u->src[1];
+				u->src[1] = u->src[2];
+				u->src[2] = tmp;
+			} else {
+				/* NV computes src0 * src1 + src2 * src3, src3 is set to 1 */
+				u->mode = GL_COMBINE4_NV;
+				u->op = in->op == OP_MODULATE_ADD ? GL_ADD : GL_ADD_SIGNED;
+
+				/* the alpha combiner goes four operand too, and can only
+				 * add: keep the default product, with 0 * 1 added to it.
+				 */
+				u->alpha_op = GL_ADD;
+				u->alpha_src[2] = GL_ZERO;
+				u->alpha_src_count = 3;
+			}
 			break;
 
 		default:
-			res = GL_TEXTURE;
+			break;
 		}
-	} else {
-		res = GL_PREVIOUS;
 	}
 
-	return res;
+	if(aprog && setup_alpha(comp, aprog, slot_unit) == -1) {
+		return -1;
+	}
+
+	/* a unit takes part in the cascade only while texturing is enabled
+	 * on it, so units which don't sample a texture of their own borrow
+	 * the one of a nearby unit. The default alpha of such a unit would
+	 * multiply the alpha of the borrowed texture in again, so it passes
+	 * the previous alpha through instead.
+	 */
+	for(i=0; i<comp->unit_count; i++) {
+		struct unit *u = comp->unit + i;
+
+		if(u->tex >= 0) continue;
+
+		for(j=1; j<comp->unit_count; j++) {
+			if(i - j >= 0 && comp->unit[i - j].tex >= 0) {
+				u->tex = comp->unit[i - j].tex;
+				break;
+			}
+			if(i + j < comp->unit_count && comp->unit[i + j].tex >= 0) {
+				u->tex = comp->unit[i + j].tex;
+				break;
+			}
+		}
+
+		if(u->tex >= 0 && u->alpha_src[0] == GL_TEXTURE) {
+			if(u->mode == GL_COMBINE4_NV) {
+				/* 0 * 0 + previous * 1 */
+				u->alpha_src[0] = u->alpha_src[1] = GL_ZERO;
+				u->alpha_src[2] = GL_PREVIOUS;
+			} else {
+				u->alpha_op = GL_REPLACE;
+				u->alpha_src[0] = u->alpha_src[1] = GL_PREVIOUS;
+			}
+		}
+	}
+
+	/* combiner signatures, used for sorting states */
+	for(i=0; i<comp->unit_count; i++) {
+		struct unit *u = comp->unit + i;
+		unsigned int h = u->op;
+
+		h = h * 31 + u->mode;
+		h = h * 31 + u->src[0];
+		h = h * 31 + u->src[1];
+		h = h * 31 + u->src[2];
+		h = h * 31 + u->scale;
+		h = h * 31 + u->alpha_op;
+		h = h * 31 + u->alpha_src[0];
+		h = h * 31 + u->alpha_src[1];
+		h = h * 31 + u->alpha_src[2];
+		h = h * 31 + u->alpha_scale;
+		if(u->has_color) {
+			for(j=0; j<4; j++) {
+				h = h * 31 + (unsigned int)(u->color[j] * 255.0f);
+			}
+		}
+		u->sig = h;
+	}
+	return 0;
 }
 
-static void bind_texture(unsigned int tex) {
-	const GLenum *tptr = tex_type;
+/* --- setup_alpha() ---
+ * places the alpha program on consecutive units, as late as possible
+ * on the units of the color program, where the textures and constants
+ * it needs don't clash with the ones of the color program. If it doesn't
+ * fit anywhere, it goes on extra units after them. All other units pass
+ * the previous alpha through.
+ */
+static int setup_alpha(struct compiled *comp, const struct program *prog, int *slot_unit) {
+	int i, off, n = prog->count, count = comp->unit_count;
+
+	if(prog->tex_count > comp->tex_count) {
+		comp->tex_count = prog->tex_count;
+	}
 
-	do {
-		glGetError();	/* clear errors */
-		glBindTexture(*tptr, tex);
-	} while(glGetError() != GL_NO_ERROR && *++tptr);
+	for(off = count > n ? count - n : 0; off >= 0; off--) {
+		if(fit_alpha(comp, prog, off)) break;
+	}
+	if(off < 0) off = count;
 
-	if(*tptr) glEnable(*tptr);
+	for(i=count; i<off + n; i++) {
+		pass_unit(comp->unit + i);
+	}
+	if(off + n > count) {
+		comp->unit_count = off + n;
+	}
+
+	for(i=0; i<count; i++) {
+		struct unit *u = comp->unit + i;
+
+		u->alpha_op = GL_REPLACE;
+		u->alpha_src[0] = u->alpha_src[1] = u->alpha_src[2] = GL_PREVIOUS;
+		u->alpha_src_count = 2;
+		u->alpha_scale = 1;
+	}
+
+	for(i=0; i<n; i++) {
+		if(alpha_unit(comp, prog, i, off + i, slot_unit) == -1) return -1;
+	}
+	return 0;
 }
 
+/* checks if the alpha program can run on the units starting at off,
+ * units past the end of the color program are always free.
+ */
+static int fit_alpha(const struct compiled *comp, const struct program *prog, int off) {
+	int i, j;
 
-static int handle_operand(struct symbol *symb, const unsigned int *tex) {
-	int operand = symbol_to_glsource(symb);
+	for(i=0; i<prog->count && off + i < comp->unit_count; i++) {
+		const struct instr *in = prog->code + i;
+		const struct unit *u = comp->unit + off + i;
 
-	if(operand == GL_TEXTURE) {
-		bind_texture(tex[symb->symb - SYMB_T0]);
-	} else if(operand == GL_CONSTANT) {
-		glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, symb->val.value);
+		if(u->mode != GL_COMBINE) return 0;
+
+		for(j=0; j<MAX_SOURCES; j++) {
+			int arg = in->arg[j];
+
+			if(in->src[j] == SRC_TEX) {
+				/* with the crossbar, textures can come from any unit */
+				if(!(prog->flags & PROG_CROSSBAR) && u->tex != -1 && u->tex != arg) {
+					return 0;
+				}
+			} else if(in->src[j] == SRC_CONST) {
+				if((u->has_color & COLOR_ALPHA) && u->color[3] != prog->consts[arg][3]) {
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/* sets up the alpha combiner of unit k for instruction i of the alpha program */
+static int alpha_unit(struct compiled *comp, const struct program *prog, int i, int k, int *slot_unit) {
+	int j, n;
+	const struct instr *in = prog->code + i;
+	struct unit *u = comp->unit + k;
+
+	u->alpha_op = op_to_glcombine(in->op);
+	u->alpha_src_count = op_sources(in->op);
+	u->alpha_scale = in->scale;
+
+	for(j=0; j<MAX_SOURCES; j++) {
+		int slot = in->arg[j];
+
+		u->alpha_src[j] = src_to_glsource(in->src[j]);
+
+		if(in->src[j] == SRC_TEX) {
+			if(!(prog->flags & PROG_CROSSBAR)) {
+				u->tex = slot;	/* fit_alpha made sure it's free */
+				continue;
+			}
+
+			if(slot_unit[slot] == -1) {
+				/* not bound yet: to this unit if it's free, or else to
+				 * any unit left without a texture.
+				 */
+				if(u->tex == -1) {
+					n = k;
+				} else {
+					for(n=0; n<comp->unit_count && comp->unit[n].tex != -1; n++);
+					if(n == comp->unit_count) {
+						pass_unit(comp->unit + comp->unit_count++);
+					}
+				}
+				comp->unit[n].tex = slot;
+				slot_unit[slot] = n;
+			}
+			if(slot_unit[slot] != k) {
+				u->alpha_src[j] = GL_TEXTURE0 + slot_unit[slot];
+			}
+		} else if(in->src[j] == SRC_CONST) {
+			if(pack_color(u, prog->consts[slot], COLOR_ALPHA) == -1) return -1;
+		}
 	}
 
-	return operand;
+	if(in->op == OP_MODULATE_ADD || in->op == OP_MODULATE_SIGNED_ADD) {
+		/* ATI computes src0 * src2 + src1 */
+		GLenum tmp = u->alpha_src[1];
+		u->alpha_src[1] = u->alpha_src[2];
+		u->alpha_src[2] = tmp;
+	}
+	return 0;
 }
 
-static int set_tex_state_rec(const struct ptree *t, const unsigned int *tex, int height) {
-	if(!t) return 0;
+/* sets up a unit which passes the previous result through */
+static void pass_unit(struct unit *u) {
+	u->tex = -1;
+	u->mode = GL_COMBINE;
+	u->op = GL_REPLACE;
+	u->src[0] = u->src[1] = u->src[2] = GL_PREVIOUS;
+	u->src_count = 2;
+	u->scale = 1;
+	u->alpha_op = GL_REPLACE;
+	u->alpha_src[0] = u->alpha_src[1] = u->alpha_src[2] = GL_PREVIOUS;
+	u->alpha_src_count = 2;
+	u->alpha_scale = 1;
+	u->has_color = 0;
+}
 
-	if(set_tex_state_rec(t->left, tex, height - 1) == -1) return -1;
-	if(set_tex_state_rec(t->right, tex, height - 1) == -1) return -1;
+/* packs a constant operand into a part of the constant color of its
+ * unit, all constant operands of a unit must agree on the color
+ * components the combiners read.
+ */
+static int pack_color(struct unit *u, const float *color, int part) {
+	float *c = u->color;
 
-	if(t->symb.type == SYMB_TYPE_OP) {
-		int s0, s1, op;
+	if(part == COLOR_RGB) {
+		if(u->has_color & COLOR_RGB) {
+			return c[0] == color[0] && c[1] == color[1] && c[2] == color[2] ? 0 : -1;
+		}
+		c[0] = color[0];
+		c[1] = color[1];
+		c[2] = color[2];
+		if(!(u->has_color & COLOR_ALPHA)) c[3] = color[3];
+	} else {
+		if(u->has_color & COLOR_ALPHA) {
+			return c[3] == color[3] ? 0 : -1;
+		}
+		if(!(u->has_color & COLOR_RGB)) c[0] = c[1] = c[2] = 0.0f;
+		c[3] = color[3];
+	}
+	u->has_color |= part;
+	return 0;
+}
+
+/* --- bind_slots() ---
+ * With the crossbar, any unit can sample the texture bound to another
+ * one (GL_TEXTUREn), so every texture is bound just once: to the first
+ * unit using it which doesn't have a texture yet, or else to any unit
+ * left without one. Textures that still don't fit get extra units at the
+ * end, which pass the result through. Returns the number of units.
+ */
+static int bind_slots(struct compiled *comp, const struct program *prog, int *slot_unit) {
+	int i, j, k, pass, count = prog->count;
+
+	for(i=0; i<count; i++) {
+		comp->unit[i].tex = -1;
+	}
 
-		if(!t->left || !t->right) {
-			fprintf(stderr, "came upon a binary operator with less than two operands!?\n");
+	for(pass=0; pass<2; pass++) {
+		for(i=0; i<prog->count; i++) {
+			const struct instr *in = prog->code + i;
+
+			for(j=0; j<MAX_SOURCES; j++) {
+				int slot = in->arg[j];
+
+				if(in->src[j] != SRC_TEX || slot_unit[slot] != -1) continue;
+
+				if(pass == 0) {
+					if(comp->unit[i].tex != -1) continue;
+					k = i;
+				} else {
+					for(k=0; k<count && comp->unit[k].tex != -1; k++);
+
+					if(k == count) {
+						pass_unit(comp->unit + count++);
+					}
+				}
+				comp->unit[k].tex = slot;
+				slot_unit[slot] = k;
+			}
+		}
+	}
+	return count;
+}
+
+static GLenum lookup_target(unsigned int tex) {
+	unsigned int i;
+
+	if(!tex_reg_size) return 0;
+
+	i = tex % tex_reg_size;
+	while(tex_reg[i].target) {
+		if(tex_reg[i].tex == tex) return tex_reg[i].target;
+		i = (i + 1) % tex_reg_size;
+	}
+	return 0;
+}
+
+/* --- resolve_targets() ---
+ * states may be created without a current context, on any thread, so
+ * the targets of textures that weren't registered by then are found out
+ * on the thread of the context, before the state is first used: from the
+ * registry if they were registered since, or by trial and error. Each
+ * unit probes the texture of its own slot, like it'll bind it next.
+ */
+static void resolve_targets(const struct mtexp *state) {
+	int i;
+
+	for(i=0; i<state->tex_count; i++) {
+		if(state->target[i]) continue;
+
+		if(!(state->target[i] = lookup_target(state->tex[i]))) {
+			gls_active_unit(i < gls_get_max_units() ? i : 0);
+			state->target[i] = gls_probe_target(state->tex[i]);
+		}
+	}
+}
+
+/* --- enable_shader() ---
+ * binds tN to unit N and makes the shader current, linking it the first
+ * time any state of the expression gets here. A state that turns out to
+ * have a texture other than a 2D one, or whose shader fails to link,
+ * goes back to the units for good, returning -1.
+ */
+static int enable_shader(const struct mtexp *state) {
+	struct mtexp *ts = (struct mtexp*)state;
+	struct compiled *comp = (struct compiled*)state->comp;
+	int i;
+
+	for(i=0; i<state->tex_count; i++) {
+		if(state->target[i] != GL_TEXTURE_2D) {
+			ts->shader = 0;
+			ts->passes = comp->pass_count;
+			gls_use_program(0);
 			return -1;
 		}
+	}
+
+	if(!comp->shader_linked) {
+		comp->shader = make_shader(comp->glsl);
+		comp->shader_linked = 1;
+	}
+	if(!comp->shader) {
+		ts->shader = 0;
+		ts->passes = comp->pass_count;
+		gls_use_program(0);
+		return -1;
+	}
+
+	for(i=0; i<state->tex_count; i++) {
+		gls_active_unit(i);
+		gls_bind_texture(GL_TEXTURE_2D, state->tex[i]);
+	}
+	gls_use_program(comp->shader);
+	return 0;
+}
+
+static void enable_unit(const struct mtexp *state, const struct compiled *pass, int i) {
+	const struct unit *u = pass->unit + i;
 
-		active_unit(height);
+	gls_active_unit(i);
 
-		op = symbol_to_glcombine(t->symb.symb);
-		s0 = handle_operand(&t->left->symb, tex);
-		s1 = handle_operand(&t->right->symb, tex);
+	if(is_temp(pass, u->tex)) {
+		gls_bind_texture(GL_TEXTURE_2D, gls_temp_texture(u->tex - pass->temp_base));
+		gls_enable(GL_TEXTURE_2D);
+		gls_screen_texgen(1);
+	} else if(u->tex >= 0) {
+		gls_bind_texture(state->target[u->tex], state->tex[u->tex]);
+		gls_enable(state->target[u->tex]);
+	}
+	if(u->has_color) gls_tex_envfv(GL_TEXTURE_ENV_COLOR, u->color);
+
+	gls_tex_envi(GL_TEXTURE_ENV_MODE, u->mode);
+	gls_tex_envi(GL_COMBINE_RGB, u->op);
+	gls_tex_envi(GL_SOURCE0_RGB, u->src[0]);
+	gls_tex_envi(GL_SOURCE1_RGB, u->src[1]);
+	if(u->src_count > 2) {
+		/* the third operand defaults to the source alpha */
+		gls_tex_envi(GL_SOURCE2_RGB, u->src[2]);
+		gls_tex_envi(GL_OPERAND2_RGB, GL_SRC_COLOR);
+	}
+	if(u->mode == GL_COMBINE4_NV) {
+		gls_tex_envi(GL_SOURCE3_RGB_NV, GL_ZERO);
+		gls_tex_envi(GL_OPERAND3_RGB_NV, GL_ONE_MINUS_SRC_COLOR);
+	}
+	gls_tex_envi(GL_RGB_SCALE, u->scale);
 
-		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
-		glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, op);
-		glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB, s0);
-		glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_RGB, s1);
+	/* GL_COMBINE4_NV only runs when there's no alpha expression, but it
+	 * switches the alpha combiner to four operands as well, which only
+	 * add. The fourth one is 1, like the one of the color combiner.
+	 */
+	if(u->mode == GL_COMBINE || u->mode == GL_COMBINE4_NV) {
+		gls_tex_envi(GL_COMBINE_ALPHA, u->alpha_op);
+		gls_tex_envi(GL_SOURCE0_ALPHA, u->alpha_src[0]);
+		gls_tex_envi(GL_SOURCE1_ALPHA, u->alpha_src[1]);
+		if(u->alpha_src_count > 2) {
+			gls_tex_envi(GL_SOURCE2_ALPHA, u->alpha_src[2]);
+		}
+		if(u->mode == GL_COMBINE4_NV) {
+			gls_tex_envi(GL_SOURCE3_ALPHA_NV, GL_ZERO);
+			gls_tex_envi(GL_OPERAND3_ALPHA_NV, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		gls_tex_envi(GL_ALPHA_SCALE, u->alpha_scale);
+	}
 
 #ifdef DEBUG
-		if(first_call) {
-			printf("\nunit(%d)\n", height);
-			printf("op(%s)\n", t->symb.str);
-			printf("src0(%s)\n", s0 == GL_PREVIOUS ? "prev" : (s0 == GL_TEXTURE ? "tex" : (s0 == GL_CONSTANT ? "con" : "col")));
-			printf("src1(%s)\n", s1 == GL_PREVIOUS ? "prev" : (s1 == GL_TEXTURE ? "tex" : (s1 == GL_CONSTANT ? "con" : "col")));
+	if(first_call) {
+		int j;
+		printf("\nunit(%d)\n", i);
+		printf("op(%x) tex(%d) scale(%d)\n", u->op, u->tex, u->scale);
+		for(j=0; j<u->src_count; j++) {
+			int s = u->src[j];
+			if(s >= GL_TEXTURE0 && s < GL_TEXTURE0 + 32) {
+				printf("src%d(tex%d)\n", j, s - GL_TEXTURE0);
+				continue;
+			}
+			printf("src%d(%s)\n", j, s == GL_PREVIOUS ? "prev" : (s == GL_TEXTURE ? "tex" : (s == GL_CONSTANT ? "con" : "col")));
 		}
+		if(pass->has_alpha) {
+			printf("alpha op(%x) scale(%d) src(%x %x %x)\n", u->alpha_op, u->alpha_scale,
+					u->alpha_src[0], u->alpha_src[1], u->alpha_src[2]);
+		}
+	}
 #endif	/* DEBUG */
+}
+
+static void disable_unit(const struct mtexp *state, const struct compiled *pass, int i) {
+	int tex = pass->unit[i].tex;
+
+	if(tex < 0) return;	/* nothing was enabled on this unit */
+
+	gls_active_unit(i);
+
+	if(is_temp(pass, tex)) {
+		gls_screen_texgen(0);
 	}
+	if(state->target[tex]) {
+		gls_disable(state->target[tex]);
+	} else {
+		const GLenum *tptr = gls_tex_type;
+		while(*tptr) gls_disable(*tptr++);
+	}
+}
 
-	return 0;
+static int is_temp(const struct compiled *pass, int slot) {
+	return slot >= pass->temp_base;
 }
 
-static int height(struct ptree *t) {
-	int hleft, hright;
-	if(!t) return 0;
+/* makes a state run another compilation of its expression, the slots
+ * after the ones of the expression are cleared.
+ */
+static void set_comp(struct mtexp *ts, const struct compiled *comp) {
+	int i;
+
+	ts->comp = comp;
+	ts->passes = comp->pass_count;
+	ts->tex_count = comp->tex_count;
 
-	hleft = height(t->left);
-	hright = height(t->right);
-	return 1 + (hleft > hright ? hleft : hright);
+	for(i=comp->tex_count; i<ts->slot_count; i++) {
+		ts->tex[i] = 0;
+		ts->target[i] = i >= comp->temp_base ? GL_TEXTURE_2D : 0;
+	}
 }
 
-static int count_ops(struct ptree *t) {
-	if(!t) return 0;
-	return count_ops(t->left) + count_ops(t->right) + (t->symb.type == SYMB_TYPE_OP ? 1 : 0);
+/* puts a baked state back to running the whole expression */
+static void drop_bake(struct mtexp *state) {
+	struct bake *bake = state->bake;
+
+	if(!bake) return;
+
+	mtexp_bake_remove(bake);
+
+	state->bake = 0;
+	state->own_comp = bake->orig_own;
+	state->key = base_key(state);
+	set_comp(state, bake->orig_comp);
+	make_sort_key(state);
+
+	mtexp_free_compiled(bake->comp);
+	mtexp_free_program(bake->prog);
+	mtexp_free_ptree(bake->tree);
+	free(bake->key);
+	free(bake);
 }
 
-static int is_symb_texture(int s) {
-	return (s >= SYMB_T0 && s <= SYMB_T3) ? 1 : 0;
+/* two units are the same if enabling one after the other changes nothing */
+static int same_unit(const struct mtexp *a, const struct mtexp *b, int i) {
+	const struct unit *ua = a->comp->unit + i;
+	const struct unit *ub = b->comp->unit + i;
+
+	if(ua->tex >= 0 || ub->tex >= 0) {
+		if(ua->tex < 0 || ub->tex < 0) return 0;
+		if(a->tex[ua->tex] != b->tex[ub->tex]) return 0;
+		if(!a->target[ua->tex] || a->target[ua->tex] != b->target[ub->tex]) return 0;
+	}
+	if(ua == ub) return 1;
+
+	if(ua->mode != ub->mode || ua->op != ub->op || ua->scale != ub->scale) return 0;
+	if(ua->src[0] != ub->src[0] || ua->src[1] != ub->src[1]) return 0;
+	if(ua->src_count > 2 && ua->src[2] != ub->src[2]) return 0;
+	if(ua->mode == GL_COMBINE) {
+		if(ua->alpha_op != ub->alpha_op || ua->alpha_scale != ub->alpha_scale) return 0;
+		if(ua->alpha_src[0] != ub->alpha_src[0] || ua->alpha_src[1] != ub->alpha_src[1]) return 0;
+		if(ua->alpha_src_count > 2 && ua->alpha_src[2] != ub->alpha_src[2]) return 0;
+	}
+	if(ua->has_color != ub->has_color) return 0;
+	return !ua->has_color || memcmp(ua->color, ub->color, sizeof ua->color) == 0;
+}
+
+/* --- make_sort_key() ---
+ * texture binds are the most expensive changes, so the textures of all
+ * units come first, followed by the combiner signature of each unit.
+ * States sorted by this key share as many leading units as possible.
+ */
+/* --- update_comp() ---
+ * expressions compiled before the features of the implementation were
+ * known, or for another dispatch table, are compiled again for the ones
+ * of the current context, the first time they're enabled. Baked states
+ * are compiled on the thread of the context already. Returns 1 if the
+ * state was compiled again, -1 on error.
+ */
+static int update_comp(const struct mtexp *state) {
+	struct mtexp *ts = (struct mtexp*)state;
+	struct compiled *comp;
+
+	if(!gls_caps_known()) mtexp_init();
+
+	if(state->bake || (state->comp->caps == gls_get_caps() &&
+				state->comp->max_units == gls_get_max_units())) {
+		return 0;
+	}
+	if(!state->comp->expr || !(comp = mtexp_compile_expr(state->comp->expr))) {
+		return -1;
+	}
+
+	/* the sort key is allocated along with the state, for its own units */
+	if(comp->unit_count > state->key_units) {
+		unsigned int *key;
+
+		if(!(key = malloc(2 * comp->unit_count * sizeof *key))) {
+			mtexp_free_compiled(comp);
+			return -1;
+		}
+		free(ts->key_buf);
+		ts->key_buf = key;
+		ts->key_units = comp->unit_count;
+	}
+	ts->key = base_key(ts);
+
+	if(state->own_comp) {
+		mtexp_free_compiled((struct compiled*)state->comp);
+	}
+	ts->own_comp = 1;
+	set_comp(ts, comp);
+	set_shader(ts);
+	make_sort_key(ts);
+	return 1;
 }
 
-static int count_tex_usage(struct ptree *t) {
-	if(!t) return 0;
-	return is_symb_texture(t->symb.symb) + count_tex_usage(t->left) + count_tex_usage(t->right);
+/* shaders sample 2D textures, unregistered ones are checked later */
+static void set_shader(struct mtexp *ts) {
+	int i;
+
+	ts->shader = ts->comp->glsl != 0;
+	for(i=0; i<ts->tex_count; i++) {
+		if(ts->target[i] && ts->target[i] != GL_TEXTURE_2D) ts->shader = 0;
+	}
+	if(ts->shader) ts->passes = 1;
 }
 
+/* the sort key of the state when it isn't baked */
+static unsigned int *base_key(struct mtexp *ts) {
+	return ts->key_buf ? ts->key_buf : (unsigned int*)(ts + 1);
+}
+
+static void make_sort_key(struct mtexp *ts) {
+	int i, n = ts->comp->unit_count;
+
+	for(i=0; i<n; i++) {
+		const struct unit *u = ts->comp->unit + i;
+
+		ts->key[i] = u->tex >= 0 ? ts->tex[u->tex] : 0;
+		ts->key[n + i] = u->sig;
+	}
+}
@@ -23,17 +23,202 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define _MTEXP_H_
 
 struct mtexp;
+struct mtexp_queue;
+struct mtexp_cache;
+
+/* draw callback of render queue items */
+typedef void (*mtexp_draw_func)(void *cls);
+
+/* kinds of OpenGL calls counted in struct mtexp_stats */
+enum {
+	MTEXP_CALL_ACTIVE,	/* active texture unit changes */
+	MTEXP_CALL_TEXENV,	/* glTexEnv */
+	MTEXP_CALL_BIND,	/* glBindTexture */
+	MTEXP_CALL_ENABLE,	/* glEnable/glDisable of texture targets */
+	MTEXP_CALL_PROGRAM,	/* glUseProgram */
+
+	MTEXP_NUM_CALL_KINDS
+};
+
+/* libmtexp keeps a shadow copy of the texture unit state it sets, and
+ * only calls OpenGL for values that actually change. These counters
+ * show how many calls of each kind were issued, and how many were
+ * filtered out as redundant.
+ */
+struct mtexp_stats {
+	unsigned long issued[MTEXP_NUM_CALL_KINDS];
+	unsigned long filtered[MTEXP_NUM_CALL_KINDS];
+};
+
+/* table of the OpenGL entry points used by libmtexp. Every OpenGL call
+ * goes through the current table, which can be replaced to run libmtexp
+ * without an OpenGL context (see the mock backend below). Arguments are
+ * the plain C equivalents of the OpenGL types (GLenum, GLint etc).
+ */
+struct mtexp_gl {
+	void (*active_texture)(unsigned int unit);
+	void (*client_active_texture)(unsigned int unit);
+	void (*tex_envi)(unsigned int target, unsigned int pname, int val);
+	void (*tex_envfv)(unsigned int target, unsigned int pname, const float *val);
+	void (*bind_texture)(unsigned int target, unsigned int tex);
+	void (*enable)(unsigned int cap);
+	void (*disable)(unsigned int cap);
+	unsigned int (*get_error)(void);
+	const char *(*get_string)(unsigned int name);
+	void (*get_integerv)(unsigned int pname, int *val);
+	void (*blend_func)(unsigned int src, unsigned int dst);
+
+	/* render to texture temporaries */
+	void (*gen_textures)(int n, unsigned int *tex);
+	void (*delete_textures)(int n, const unsigned int *tex);
+	void (*tex_image_2d)(unsigned int target, int level, int ifmt, int width, int height, int border, unsigned int fmt, unsigned int type, const void *pixels);
+	void (*tex_parameteri)(unsigned int target, unsigned int pname, int val);
+	void (*copy_tex_sub_image_2d)(unsigned int target, int level, int xoffs, int yoffs, int x, int y, int width, int height);
+	void (*tex_geni)(unsigned int coord, unsigned int pname, int val);
+	void (*tex_genfv)(unsigned int coord, unsigned int pname, const float *val);
+	void (*matrix_mode)(unsigned int mode);
+	void (*push_matrix)(void);
+	void (*pop_matrix)(void);
+	void (*load_matrixf)(const float *mat);
+	void (*get_floatv)(unsigned int pname, float *val);
+
+	/* baking of static subexpressions */
+	void (*get_tex_level_parameteriv)(unsigned int target, int level, unsigned int pname, int *val);
+	void (*get_tex_image)(unsigned int target, int level, unsigned int fmt, unsigned int type, void *pixels);
+
+	/* GLSL fragment shaders, null if there are none */
+	unsigned int (*create_shader)(unsigned int type);
+	void (*shader_source)(unsigned int sdr, const char *src);
+	void (*compile_shader)(unsigned int sdr);
+	void (*get_shaderiv)(unsigned int sdr, unsigned int pname, int *val);
+	void (*get_shader_info_log)(unsigned int sdr, int size, char *buf);
+	void (*delete_shader)(unsigned int sdr);
+	unsigned int (*create_program)(void);
+	void (*attach_shader)(unsigned int prog, unsigned int sdr);
+	void (*link_program)(unsigned int prog);
+	void (*get_programiv)(unsigned int prog, unsigned int pname, int *val);
+	void (*get_program_info_log)(unsigned int prog, int size, char *buf);
+	void (*delete_program)(unsigned int prog);
+	void (*use_program)(unsigned int prog);
+	int (*get_uniform_location)(unsigned int prog, const char *name);
+	void (*uniform1i)(int loc, int val);
+	void (*uniform4fv)(int loc, int count, const float *val);
+};
+
+/* functions of struct mtexp_gl, as recorded by the mock backend */
+enum {
+	MTEXP_GL_ACTIVE_TEXTURE,
+	MTEXP_GL_CLIENT_ACTIVE_TEXTURE,
+	MTEXP_GL_TEX_ENVI,
+	MTEXP_GL_TEX_ENVFV,
+	MTEXP_GL_BIND_TEXTURE,
+	MTEXP_GL_ENABLE,
+	MTEXP_GL_DISABLE,
+	MTEXP_GL_GET_ERROR,
+	MTEXP_GL_GET_STRING,
+	MTEXP_GL_GET_INTEGERV,
+	MTEXP_GL_BLEND_FUNC,
+	MTEXP_GL_GEN_TEXTURES,
+	MTEXP_GL_DELETE_TEXTURES,
+	MTEXP_GL_TEX_IMAGE_2D,
+	MTEXP_GL_TEX_PARAMETERI,
+	MTEXP_GL_COPY_TEX_SUB_IMAGE_2D,
+	MTEXP_GL_TEX_GENI,
+	MTEXP_GL_TEX_GENFV,
+	MTEXP_GL_MATRIX_MODE,
+	MTEXP_GL_PUSH_MATRIX,
+	MTEXP_GL_POP_MATRIX,
+	MTEXP_GL_LOAD_MATRIXF,
+	MTEXP_GL_GET_FLOATV,
+	MTEXP_GL_GET_TEX_LEVEL_PARAMETERIV,
+	MTEXP_GL_GET_TEX_IMAGE,
+	MTEXP_GL_CREATE_SHADER,
+	MTEXP_GL_SHADER_SOURCE,
+	MTEXP_GL_COMPILE_SHADER,
+	MTEXP_GL_GET_SHADERIV,
+	MTEXP_GL_GET_SHADER_INFO_LOG,
+	MTEXP_GL_DELETE_SHADER,
+	MTEXP_GL_CREATE_PROGRAM,
+	MTEXP_GL_ATTACH_SHADER,
+	MTEXP_GL_LINK_PROGRAM,
+	MTEXP_GL_GET_PROGRAMIV,
+	MTEXP_GL_GET_PROGRAM_INFO_LOG,
+	MTEXP_GL_DELETE_PROGRAM,
+	MTEXP_GL_USE_PROGRAM,
+	MTEXP_GL_GET_UNIFORM_LOCATION,
+	MTEXP_GL_UNIFORM1I,
+	MTEXP_GL_UNIFORM4FV
+};
+
+/* a call recorded by the mock backend, arg holds the enum/integer
+ * arguments in order, and val the value of glTexEnv/glTexGen calls
+ * (the first row of glLoadMatrixf, the region of glCopyTexSubImage2D,
+ * the value of glUniform, the object or location returned by the
+ * glCreate and glGetUniformLocation calls).
+ */
+struct mtexp_mock_call {
+	int func;
+	unsigned int arg[2];
+	union {
+		int i;
+		float f[4];
+	} val;
+};
+
+/* setup of a single texture unit of a state, as chosen by the scheduler */
+struct mtexp_unit_info {
+	int slot;				/* texture slot (the N of tN) bound to the unit, -1 for none */
+	unsigned int tex;		/* texture object bound to the unit */
+	unsigned int mode;		/* GL_TEXTURE_ENV_MODE (GL_COMBINE, GL_COMBINE4_NV) */
+	unsigned int combine;	/* GL_COMBINE_RGB */
+	unsigned int src[3];	/* GL_SOURCEn_RGB, src_count of them are used */
+	int src_count;
+	int scale;				/* GL_RGB_SCALE */
+	unsigned int alpha_combine;		/* GL_COMBINE_ALPHA */
+	unsigned int alpha_src[3];		/* GL_SOURCEn_ALPHA, alpha_src_count of them are used */
+	int alpha_src_count;
+	int alpha_scale;		/* GL_ALPHA_SCALE */
+	int has_color;
+	float color[4];			/* GL_TEXTURE_ENV_COLOR, if has_color is set */
+};
 
 #ifdef __cplusplus
 extern "C" {
 #endif	/* __cplusplus */
 
-/* creates an mtexp state from the specified expression and texture ids */
+/* initializes libmtexp and detects the features of the OpenGL context,
+ * which must be current. Expressions are compiled for the features known
+ * at the time, without calling OpenGL, so programs creating states on
+ * other threads should call this first, on the thread of the context.
+ * States compiled before are compiled again the first time they're
+ * enabled. mtexp_set_gl detects the features too.
+ * Returns -1 if there is no current context.
+ */
+int mtexp_init(void);
+
+/* creates an mtexp state from the specified expression and texture ids.
+ * One texture id is passed for every slot up to the highest tN used in
+ * the expression (any N, as long as the units can fit the expression),
+ * even if the same slot appears more than once. An alpha
+ * expression may follow the color one after a semicolon ("rgb ; alpha"),
+ * where operands stand for their alpha, and <r g b a> constants for a.
+ */
 struct mtexp *mtexp_create(const char *expr, ...);
 
 /* frees the memory of an mtexp state */
 void mtexp_free(struct mtexp *state);
 
+/* expression cache: every distinct expression is compiled only once, and
+ * all states created from it through the cache share the compiled form,
+ * keeping only their texture objects. A cache may only be used by one
+ * thread at a time, and must outlive the states created through it.
+ */
+struct mtexp_cache *mtexp_cache_create(void);
+void mtexp_cache_free(struct mtexp_cache *cache);
+
+/* same as mtexp_create, looking up the expression in the cache first */
+struct mtexp *mtexp_create_cached(struct mtexp_cache *cache, const char *expr, ...);
+
 /* sets up the multitexturing environment according to the
  * mtexp state passed.
  */
@@ -44,6 +229,158 @@ int mtexp_enable(const struct mtexp *state);
  */
 void mtexp_disable(const struct mtexp *state);
 
+/* switches from one mtexp state to another, calling OpenGL only for the
+ * units that differ between the two. Equivalent to disabling the first
+ * and enabling the second, either of which may be null.
+ */
+int mtexp_switch(const struct mtexp *from, const struct mtexp *to);
+
+/* expressions needing more texture units than there are, are split in
+ * several rendering passes, which add up or multiply in the framebuffer.
+ * Subexpressions that can't be split like that are rendered first, and
+ * copied from the framebuffer to temporary textures which the later
+ * passes read back in screen space. Returns the number of passes of a
+ * state, 1 for most of them.
+ */
+int mtexp_get_passes(const struct mtexp *state);
+
+/* enables a single pass of a state, the geometry has to be drawn once
+ * for each pass, in order. mtexp_enable is the same as enabling the
+ * first pass. The passes of multipass states set up blending, and the
+ * depth test has to let the same fragments through again (GL_LEQUAL),
+ * mtexp_disable turns blending off. Passes reading temporaries use the
+ * projection matrix and viewport current when they're enabled. Returns
+ * -1 for invalid passes.
+ */
+int mtexp_enable_pass(const struct mtexp *state, int pass);
+
+/* returns the number of texture units a state uses, and fills in the
+ * setup of up to max of them in info (which may be null). Multipass
+ * states report their first pass.
+ */
+int mtexp_get_schedule(const struct mtexp *state, struct mtexp_unit_info *info, int max);
+
+/* with OpenGL 2.0, expressions are also compiled to a GLSL fragment
+ * shader, which states whose textures are all 2D run in a single pass
+ * instead of the texture units. Texture tN is read from unit N, at the
+ * texture coordinates of unit N, and mtexp_get_schedule reports one unit
+ * without combiner state for every slot. States with other textures use
+ * the units, which they find out on their first mtexp_enable unless the
+ * targets were registered with mtexp_texture_target.
+ *
+ * Returns the fragment shader generated for an expression, without
+ * calling OpenGL, in a buffer that must be freed. Null on error.
+ */
+char *mtexp_glsl_source(const char *expr);
+
+/* render queue: collects draw callbacks tagged with mtexp states, and
+ * executes them ordered so that consecutive draws share as much texture
+ * unit state as possible. Draws with identical states keep the order they
+ * were added in.
+ */
+struct mtexp_queue *mtexp_queue_create(void);
+void mtexp_queue_free(struct mtexp_queue *q);
+
+/* adds a draw to the queue, returns -1 if out of memory */
+int mtexp_queue_add(struct mtexp_queue *q, const struct mtexp *state, mtexp_draw_func draw, void *cls);
+
+/* sorts and executes all the queued draws, switching states as needed,
+ * then empties the queue. Leaves all texture units disabled.
+ */
+void mtexp_queue_flush(struct mtexp_queue *q);
+
+/* registers the target (GL_TEXTURE_2D etc) of a texture object, so that
+ * states using it never have to find it out by trial and error. Textures
+ * should be registered before states using them are first enabled, and
+ * not while other threads are creating states.
+ * returns -1 on invalid target or if out of memory.
+ */
+int mtexp_texture_target(unsigned int tex, unsigned int target);
+
+/* marks the textures of a state that change from frame to frame, bit N
+ * of dynamic standing for tN (the primary color always does). The
+ * largest part of the expression reading only the other textures and
+ * constants is computed once into a texture of its own, and the state
+ * runs just the rest on the units. That texture shows up as the slot
+ * after the ones of the expression in mtexp_get_schedule, and needs the
+ * texture coordinates of the static textures, which must share them.
+ * Only 2D textures, and expressions without an alpha part, are baked;
+ * textures from t32 on are always dynamic. States running a shader
+ * don't need baking.
+ * Returns -1 if there is nothing to bake, leaving the state as created.
+ */
+int mtexp_set_dynamic(struct mtexp *state, unsigned int dynamic);
+
+/* reports that the image of a texture changed, the states that baked it
+ * bake it again the next time they're enabled.
+ */
+void mtexp_texture_changed(unsigned int tex);
+
+/* tells libmtexp to forget its shadow copy of the texture unit state,
+ * must be called after changing texture bindings, enables or the texture
+ * environment of any unit behind libmtexp's back, and after switching
+ * OpenGL contexts.
+ */
+void mtexp_invalidate_state(void);
+
+/* deletes the temporary textures of multipass states, which are created
+ * again when needed. Must be called before destroying the context.
+ */
+void mtexp_release_temps(void);
+
+/* OpenGL call counters */
+void mtexp_get_stats(struct mtexp_stats *st);
+void mtexp_reset_stats(void);
+
+/* replaces the OpenGL dispatch table, passing a null pointer restores
+ * the default one which calls OpenGL. Also invalidates the shadow state.
+ */
+void mtexp_set_gl(const struct mtexp_gl *gl);
+
+/* mock OpenGL backend: records every call in an in-memory log instead
+ * of calling OpenGL. Texture objects get the target they are first bound
+ * to, and binding them to another one raises GL_INVALID_OPERATION, like
+ * OpenGL does. Their images read back as 2x2 texels, every byte of
+ * texture N being N modulo 256. Install it with
+ * mtexp_set_gl(mtexp_mock_gl()).
+ */
+const struct mtexp_gl *mtexp_mock_gl(void);
+
+/* returns the recorded calls, and their number through count */
+const struct mtexp_mock_call *mtexp_mock_log(int *count);
+
+/* empties the log, and optionally forgets all texture objects */
+void mtexp_mock_reset(int textures);
+
+/* creates a mock texture object of the specified target */
+void mtexp_mock_texture(unsigned int tex, unsigned int target);
+
+/* sets the GL_EXTENSIONS string of the mock (empty by default), the
+ * string isn't copied. Extensions are detected when the dispatch table
+ * is set, so this should be called before mtexp_set_gl.
+ */
+void mtexp_mock_extensions(const char *ext);
+
+/* sets the GL_VERSION of the mock ("1.3 mock" by default), 2.0 and
+ * later turn on the GLSL backend. Shaders always compile and link, and
+ * read up to 8 textures. The string isn't copied, and is detected along
+ * with the extensions.
+ */
+void mtexp_mock_version(const char *ver);
+
+/* sets the GL_MAX_TEXTURE_UNITS of the mock (8 by default), detected
+ * along with the extensions.
+ */
+void mtexp_mock_max_units(int units);
+
+/* sets the GL_VIEWPORT of the mock (0, 0, 640, 480 by default), which
+ * sizes the render to texture temporaries.
+ */
+void mtexp_mock_viewport(int x, int y, int width, int height);
+
+/* returns the name of a recorded function (e.g. "glBindTexture") */
+const char *mtexp_mock_func_name(int func);
+
 #ifdef __cplusplus
 }
 #endif	/* __cplusplus */
@@ -0,0 +1,477 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <string.h>
+#include "optimize.h"
+#include "program.h"
+
+#define IS_OP(t)	((t)->symb.type == SYMB_TYPE_OP)
+#define IS_CONST(t)	((t)->symb.symb == SYMB_NUM)
+#define IS_TEX(t)	((t)->symb.symb >= SYMB_T0)
+#define IS_SCALE(t)	(IS_CONST(t) && mtexp_scale_factor(t) > 1)
+#define IS_SHARED(t)	(IS_OP(t) && (t)->left == (t)->right)
+#define IS_COMMUTATIVE(op)	((op) != SYMB_MINUS)
+
+static int fold(struct ptree *t, unsigned int flags);
+static struct ptree *find_const(struct ptree *t, int op, const struct ptree *skip, struct ptree **parent);
+static void clamp_const(struct ptree *t, int op);
+static int count_ops(const struct ptree *t);
+static int is_value(const struct ptree *t, float val, unsigned int flags);
+static void splice(struct ptree *parent, struct ptree *child);
+
+static unsigned int cse(struct ptree *t, int *removed);
+static unsigned int leaf_hash(const struct ptree *t);
+
+static int reassoc(struct ptree *t);
+static void flatten(struct ptree *t, int op, struct ptree **opnd, int *nopnd, struct ptree **node, int *nnode);
+static void order_operands(struct ptree **opnd, int count);
+static void move_front(struct ptree **opnd, int from, int to);
+
+/* --- mtexp_fold_constants() ---
+ * Constants are combined with the same saturating arithmetic the texture
+ * combiners use, so the results stay in [0, 1], and so do the constants
+ * themselves, like the constant color they end up in. Regrouping them is
+ * exact for +, * and chains of -, since all values are non-negative:
+ * (x + a) + b == x + (a + b) even when the sums saturate. Alpha trees
+ * (PROG_ALPHA in flags) are checked for identities by their alpha only.
+ */
+int mtexp_fold_constants(struct ptree *t, unsigned int flags) {
+	return t ? fold(t, flags) : 0;
+}
+
+static int fold(struct ptree *t, unsigned int flags) {
+	int op, removed = 0;
+	struct ptree *c1, *c2, *p1, *p2;
+
+	if(!IS_OP(t)) return 0;
+
+	removed += fold(t->left, flags);
+	if(IS_SHARED(t)) return removed;
+	removed += fold(t->right, flags);
+
+	op = t->symb.symb;
+
+	/* both operands constant, evaluate the operator */
+	if(IS_CONST(t->left) && IS_CONST(t->right)) {
+		clamp_const(t->left, op);
+		clamp_const(t->right, op);
+		mtexp_eval_op(op, t->left->symb.val.value, t->left->symb.val.value, t->right->symb.val.value);
+		splice(t, t->left);
+		return removed + 1;
+	}
+
+	switch(op) {
+	case SYMB_PLUS:
+	case SYMB_MUL:
+		/* merge every pair of constants in this chain of the operator */
+		while((c1 = find_const(t, op, 0, &p1)) && (c2 = find_const(t, op, c1, &p2))) {
+			clamp_const(c1, op);
+			clamp_const(c2, op);
+			mtexp_eval_op(op, c1->symb.val.value, c1->symb.val.value, c2->symb.val.value);
+			splice(p2, p2->left == c2 ? p2->right : p2->left);
+			removed++;
+		}
+
+		/* x + 0 and x * 1 do nothing, x + 1 and x * 0 don't depend on x */
+		if((c1 = find_const(t, op, 0, &p1))) {
+			float ident = op == SYMB_PLUS ? 0.0f : 1.0f;
+
+			if(is_value(c1, ident, flags)) {
+				splice(p1, p1->left == c1 ? p1->right : p1->left);
+				removed++;
+			} else if(is_value(c1, 1.0f - ident, flags)) {
+				removed += count_ops(t);
+				splice(t, c1);
+			}
+		}
+		break;
+
+	case SYMB_MINUS:
+		/* (x - a) - b becomes x - (a + b) */
+		while(IS_CONST(t->right) && IS_OP(t->left) && t->left->symb.symb == SYMB_MINUS &&
+				IS_CONST(t->left->right)) {
+			struct ptree *sub = t->left;
+
+			clamp_const(sub->right, SYMB_MINUS);
+			clamp_const(t->right, SYMB_MINUS);
+			mtexp_eval_op(SYMB_PLUS, sub->right->symb.val.value, sub->right->symb.val.value, t->right->symb.val.value);
+			t->right = sub->right;
+			t->left = sub->left;
+			removed++;
+		}
+
+		if(IS_CONST(t->right) && is_value(t->right, 0.0f, flags)) {
+			splice(t, t->left);
+			removed++;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return removed;
+}
+
+/* --- mtexp_eliminate_common() ---
+ * The only result a texture unit can reuse is the one of the unit right
+ * before it, so the duplicates that can be removed are the two operands
+ * of the same operator: x (op) x runs as op(PREVIOUS, PREVIOUS) after the
+ * units computing x. Subtrees are hashed bottom-up, with the operands of
+ * commutative operators sorted by hash, so that t0 * c and c * t0 hash
+ * and compare equal.
+ */
+int mtexp_eliminate_common(struct ptree *t) {
+	int removed = 0;
+
+	if(t) cse(t, &removed);
+	return removed;
+}
+
+static unsigned int cse(struct ptree *t, int *removed) {
+	unsigned int lhash, rhash;
+	int op;
+
+	if(!IS_OP(t)) return leaf_hash(t);
+	if(IS_SHARED(t)) {
+		lhash = rhash = cse(t->left, removed);
+		return ((lhash * 33) ^ rhash) * 33 + t->symb.symb;
+	}
+
+	op = t->symb.symb;
+	lhash = cse(t->left, removed);
+	rhash = cse(t->right, removed);
+
+	if(IS_COMMUTATIVE(op) && lhash > rhash) {
+		struct ptree *tmp = t->left;
+		unsigned int htmp = lhash;
+
+		t->left = t->right;
+		t->right = tmp;
+		lhash = rhash;
+		rhash = htmp;
+	}
+
+	if(lhash == rhash && IS_OP(t->left) && mtexp_same_tree(t->left, t->right)) {
+		if(op == SYMB_MINUS) {
+			/* x - x is black, no matter what x is */
+			*removed += 2 * count_ops(t->left) + 1;
+
+			t->symb.symb = SYMB_NUM;
+			t->symb.type = SYMB_TYPE_ARG;
+			t->symb.str = "#";
+			memset(t->symb.val.value, 0, sizeof t->symb.val.value);
+			t->left = t->right = 0;
+			return leaf_hash(t);
+		}
+
+		*removed += count_ops(t->right);
+		t->right = t->left;
+	}
+
+	return ((lhash * 33) ^ rhash) * 33 + op;
+}
+
+static unsigned int leaf_hash(const struct ptree *t) {
+	unsigned int hash = t->symb.symb;
+	int i;
+
+	if(IS_CONST(t)) {
+		for(i=0; i<4; i++) {
+			hash = hash * 33 + (unsigned int)(t->symb.val.value[i] * 255.0f + 0.5f);
+		}
+	}
+	return hash;
+}
+
+int mtexp_same_tree(const struct ptree *a, const struct ptree *b) {
+	if(a == b) return 1;
+	if(a->symb.symb != b->symb.symb) return 0;
+
+	if(IS_CONST(a)) {
+		return memcmp(a->symb.val.value, b->symb.val.value, sizeof a->symb.val.value) == 0;
+	}
+	if(!IS_OP(a)) return 1;
+
+	return mtexp_same_tree(a->left, b->left) && mtexp_same_tree(a->right, b->right);
+}
+
+/* --- mtexp_reassociate() ---
+ * A texture unit can only combine the result of the previous unit with
+ * a single new operand, so the ideal tree is a left-deep chain where the
+ * right operand of every operator is a leaf. Chains of + and * are
+ * flattened and rebuilt in that shape, and the operands of the dot
+ * product are swapped when that's enough.
+ *
+ * Two different textures can't be sampled on the same unit, so the
+ * operands at the bottom of a chain are chosen to avoid that if possible.
+ * A chain with more than one compound operand can't be made to fit, those
+ * are left as they are and rejected later on.
+ */
+int mtexp_reassociate(struct ptree *t) {
+	return t ? reassoc(t) : 0;
+}
+
+static int reassoc(struct ptree *t) {
+	struct ptree *opnd[STACK_SIZE], *node[STACK_SIZE], *prev;
+	int i, op, nopnd = 0, nnode = 0, moved = 0;
+
+	if(!IS_OP(t)) return 0;
+	if(IS_SHARED(t)) return reassoc(t->left);
+
+	switch((op = t->symb.symb)) {
+	case SYMB_PLUS:
+	case SYMB_MUL:
+		flatten(t, op, opnd, &nopnd, node, &nnode);
+
+		for(i=0; i<nopnd; i++) {
+			moved += reassoc(opnd[i]);
+		}
+		order_operands(opnd, nopnd);
+
+		/* rebuild the chain bottom-up, reusing the operator nodes so
+		 * that the root of the chain stays where it is.
+		 */
+		prev = opnd[0];
+		for(i=0; i<nnode; i++) {
+			struct ptree *n = node[nnode - 1 - i];
+
+			if(n->left != prev || n->right != opnd[i + 1]) moved++;
+			n->left = prev;
+			n->right = opnd[i + 1];
+			prev = n;
+		}
+		break;
+
+	case SYMB_DOT:
+		moved += reassoc(t->left);
+		moved += reassoc(t->right);
+
+		if(!IS_OP(t->left) && IS_OP(t->right)) {
+			prev = t->left;
+			t->left = t->right;
+			t->right = prev;
+			moved++;
+		}
+		break;
+
+	case SYMB_MINUS:
+		/* x - (a + b) becomes (x - a) - b, exact for the same reason the
+		 * constant folding of chains of - is. Only worth it when x isn't
+		 * a leaf, otherwise x - PREV does the job in fewer units.
+		 */
+		if(IS_OP(t->left) && IS_OP(t->right) && t->right->symb.symb == SYMB_PLUS &&
+				!IS_SHARED(t->right)) {
+			struct ptree *sum = t->right;
+
+			sum->symb = t->symb;
+			t->right = sum->right;
+			sum->right = sum->left;
+			sum->left = t->left;
+			t->left = sum;
+			return 1 + reassoc(t);
+		}
+		moved += reassoc(t->left);
+		moved += reassoc(t->right);
+		break;
+
+	default:
+		break;
+	}
+
+	return moved;
+}
+
+/* collects the operands of a chain of the operator op, in order, along
+ * with the operator nodes of the chain, root first. A scale factor only
+ * applies to the operand it's grouped with, so operators scaling their
+ * other operand are kept whole, unless they are the root of the chain.
+ */
+static void flatten(struct ptree *t, int op, struct ptree **opnd, int *nopnd, struct ptree **node, int *nnode) {
+	if(!IS_OP(t) || t->symb.symb != op || IS_SHARED(t) ||
+			(*nnode && (IS_SCALE(t->left) || IS_SCALE(t->right)))) {
+		opnd[(*nopnd)++] = t;
+		return;
+	}
+	node[(*nnode)++] = t;
+	flatten(t->left, op, opnd, nopnd, node, nnode);
+	flatten(t->right, op, opnd, nopnd, node, nnode);
+}
+
+/* --- order_operands() ---
+ * Puts a compound operand first, since only the bottom of the chain can
+ * have one, and otherwise makes sure the first two leaves don't need two
+ * textures. Scale factors (x * 2, x * 4) are moved to the end, where they
+ * can be applied to the result of the last unit of the chain. Everything
+ * else keeps its original order.
+ */
+static void order_operands(struct ptree **opnd, int count) {
+	int i, j;
+
+	/* scale factors go last, to end up on the unit computing the rest */
+	for(i=count-1; i>=0; i--) {
+		if(IS_SCALE(opnd[i])) {
+			struct ptree *tmp = opnd[i];
+
+			for(j=i; j<count-1; j++) {
+				opnd[j] = opnd[j + 1];
+			}
+			opnd[--count] = tmp;
+		}
+	}
+
+	for(i=0; i<count; i++) {
+		if(IS_OP(opnd[i])) {
+			move_front(opnd, i, 0);
+			return;
+		}
+	}
+
+	/* a color or a constant goes along with any texture */
+	for(i=0; i<count; i++) {
+		if(!IS_TEX(opnd[i])) {
+			move_front(opnd, i, 0);
+			return;
+		}
+	}
+
+	/* otherwise try to start with the same texture twice */
+	for(i=0; i<count; i++) {
+		for(j=i+1; j<count; j++) {
+			if(opnd[j]->symb.symb == opnd[i]->symb.symb) {
+				move_front(opnd, i, 0);
+				move_front(opnd, j, 1);
+				return;
+			}
+		}
+	}
+}
+
+/* moves an operand to position to, shifting the ones in between */
+static void move_front(struct ptree **opnd, int from, int to) {
+	struct ptree *tmp = opnd[from];
+
+	for(; from>to; from--) {
+		opnd[from] = opnd[from - 1];
+	}
+	opnd[to] = tmp;
+}
+
+int mtexp_scale_factor(const struct ptree *t) {
+	const float *v = t->symb.val.value;
+
+	if(!IS_CONST(t) || v[0] != v[1] || v[1] != v[2]) return 0;
+	return v[0] == 2.0f || v[0] == 4.0f ? (int)v[0] : 0;
+}
+
+void mtexp_eval_op(int op, float *res, const float *a, const float *b) {
+	int i;
+	float dot;
+
+	switch(op) {
+	case SYMB_PLUS:
+		for(i=0; i<4; i++) res[i] = a[i] + b[i];
+		break;
+
+	case SYMB_MINUS:
+		for(i=0; i<4; i++) res[i] = a[i] - b[i];
+		break;
+
+	case SYMB_MUL:
+		for(i=0; i<4; i++) res[i] = a[i] * b[i];
+		break;
+
+	case SYMB_DOT:
+		dot = 0.0f;
+		for(i=0; i<3; i++) {
+			dot += (a[i] - 0.5f) * (b[i] - 0.5f);
+		}
+		res[0] = res[1] = res[2] = 4.0f * dot;
+		res[3] = 1.0f;
+		break;
+	}
+
+	for(i=0; i<4; i++) {
+		if(res[i] < 0.0f) res[i] = 0.0f;
+		if(res[i] > 1.0f) res[i] = 1.0f;
+	}
+}
+
+/* --- find_const() ---
+ * looks for a constant operand (other than skip) in the chain of
+ * operators op rooted at t, and returns it along with the operator
+ * node using it.
+ */
+static struct ptree *find_const(struct ptree *t, int op, const struct ptree *skip, struct ptree **parent) {
+	struct ptree *res;
+	int i;
+
+	if(!IS_OP(t) || t->symb.symb != op || IS_SHARED(t)) return 0;
+
+	for(i=0; i<2; i++) {
+		struct ptree *child = i ? t->right : t->left;
+
+		if(IS_CONST(child) && child != skip && !IS_SCALE(child)) {
+			*parent = t;
+			return child;
+		}
+		if((res = find_const(child, op, skip, parent))) {
+			return res;
+		}
+	}
+	return 0;
+}
+
+/* a constant color saturates to [0, 1] before any unit reads it, unless
+ * it's a scale factor the operator applies as the scale of a unit.
+ */
+static void clamp_const(struct ptree *t, int op) {
+	float *v = t->symb.val.value;
+	int i;
+
+	if(op == SYMB_MUL && IS_SCALE(t)) return;
+
+	for(i=0; i<4; i++) {
+		if(v[i] < 0.0f) v[i] = 0.0f;
+		if(v[i] > 1.0f) v[i] = 1.0f;
+	}
+}
+
+static int count_ops(const struct ptree *t) {
+	if(!IS_OP(t)) return 0;
+	if(IS_SHARED(t)) return 1 + count_ops(t->left);
+	return 1 + count_ops(t->left) + count_ops(t->right);
+}
+
+/* checks if the components of a constant used by the tree (all color
+ * ones, or the alpha one) have the specified value
+ */
+static int is_value(const struct ptree *t, float val, unsigned int flags) {
+	const float *v = t->symb.val.value;
+
+	if(flags & PROG_ALPHA) return v[3] == val;
+	return v[0] == val && v[1] == val && v[2] == val;
+}
+
+/* replaces a node with one of its descendants, in place */
+static void splice(struct ptree *parent, struct ptree *child) {
+	*parent = *child;
+}
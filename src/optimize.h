@@ -0,0 +1,79 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _OPTIMIZE_H_
+#define _OPTIMIZE_H_
+
+#include "parser.h"
+
+/* Optimization passes over the expression tree, run before lowering it
+ * to a program. They all rewrite the tree in place, never allocating new
+ * nodes, and keep the root node where it is, so the tree can still be
+ * freed with mtexp_free_ptree.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* evaluates operators with constant operands, merges the constants of
+ * chains of the same operator, and drops operations with identity
+ * constants (x * 1, x + 0). flags are the PROG_* flags of the program
+ * the tree is compiled to. Returns the number of operators removed.
+ */
+int mtexp_fold_constants(struct ptree *t, unsigned int flags);
+
+/* finds operators applied to two identical subtrees, computes the
+ * subtree once and makes both operands refer to it, x - x becomes 0.
+ * Shared subtrees are left in the tree as a single node with two parents
+ * (left == right), which the other passes and the lowering know about.
+ * Returns the number of operators removed.
+ */
+int mtexp_eliminate_common(struct ptree *t);
+
+/* uses the commutativity and associativity of +, * and the dot product
+ * to reshape the tree into a left-deep chain that maps directly onto the
+ * texture unit cascade, with as few units as possible. Returns the number
+ * of operators that were rearranged.
+ */
+int mtexp_reassociate(struct ptree *t);
+
+/* structural equality of two subtrees, expects the operands of
+ * commutative operators in the order mtexp_eliminate_common puts them.
+ */
+int mtexp_same_tree(const struct ptree *a, const struct ptree *b);
+
+/* returns 2 or 4 if the node is a constant that works as a scale factor
+ * of the combiner output (x * 2, x * 4), otherwise 0. Such constants are
+ * outside [0, 1] and are left alone by constant folding.
+ */
+int mtexp_scale_factor(const struct ptree *t);
+
+/* evaluates a single operator on two colors, with the saturating
+ * arithmetic of the combiners (res may be one of the operands).
+ */
+void mtexp_eval_op(int op, float *res, const float *a, const float *b);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _OPTIMIZE_H_ */
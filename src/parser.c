@@ -24,51 +24,37 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <ctype.h>
 #include "parser.h"
 
-/* operator and operand (argument) stacks */
-
-#define STACK_SIZE	100
-
-static struct symb_stack {
-	struct symbol stack[STACK_SIZE];
-	int top;
-} op_stack;
-
-static struct tree_stack {
-	struct ptree *stack[STACK_SIZE];
-	int top;
-} arg_stack;
-
-#define PUSH(s, x) ((s).stack[s.top++] = x)
-#define POP(s) ((s).stack[--s.top])
+#define PUSH(s, x) ((s).stack[(s).top++] = x)
+#define POP(s) ((s).stack[--(s).top])
 #define TOP(s) ((s).stack[(s).top - 1])
 #define SSIZE(s) ((s).top)
 
 
 /* symbol table, defines valid symbols, their type, and precedence */
 
-#define SYMB_COUNT	12
+#define SYMB_COUNT	9
 static struct symbol symb_table[SYMB_COUNT] = {
 	{"+",	SYMB_PLUS,	SYMB_TYPE_OP, {10}},
 	{"-",	SYMB_MINUS,	SYMB_TYPE_OP, {10}},
 	{"*",	SYMB_MUL,	SYMB_TYPE_OP, {20}},
 	{".",	SYMB_DOT,	SYMB_TYPE_OP, {20}},
 	{"c",	SYMB_COL,	SYMB_TYPE_ARG, {0}},
-	{"t0",	SYMB_T0,	SYMB_TYPE_ARG, {0}},
-	{"t1",	SYMB_T1,	SYMB_TYPE_ARG, {0}},
-	{"t2",	SYMB_T2,	SYMB_TYPE_ARG, {0}},
-	{"t3",	SYMB_T3,	SYMB_TYPE_ARG, {0}},
 	{"(",	SYMB_OPEN,	SYMB_TYPE_PAREN, {0}},
 	{")",	SYMB_CLOSE,	SYMB_TYPE_PAREN, {0}},
-	{"#",	SYMB_NUM,	SYMB_TYPE_ARG, {0}}
+	{"#",	SYMB_NUM,	SYMB_TYPE_ARG, {0}},
+	{"t",	SYMB_T0,	SYMB_TYPE_ARG, {0}}
 };
 
 /* forward declarations of various local functions, defined below */
-static void shift(struct symbol *s);
-static int reduce(void);
-static void clean_stacks(void);
-static struct symbol *match_symbol(const char *str);
+static void shift(struct parse_ctx *ctx, struct symbol *s);
+static int reduce(struct parse_ctx *ctx);
+static void clean_stacks(struct parse_ctx *ctx);
+static struct symbol *match_symbol(struct parse_ctx *ctx, const char *str);
+static int match_texture(struct symbol *s, const char *str);
 static const char *consume(int symb, const char *eptr);
-static struct ptree *make_ptree(struct symbol *s, struct ptree *left, struct ptree *right);
+static int count_nodes(struct parse_ctx *ctx, const char *expr);
+static struct ptree *make_ptree(struct parse_ctx *ctx, struct symbol *s, struct ptree *left, struct ptree *right);
+static void show_ptree(struct ptree *t, int lvl);
 
 
 /* --- mtexp_parse() ---
@@ -76,7 +62,36 @@ static struct ptree *make_ptree(struct symbol *s, struct ptree *left, struct ptr
  * and returns the corresponding expression tree
  */
 struct ptree *mtexp_parse(const char *expr) {
+	struct parse_ctx ctx;
+	return mtexp_parse_r(expr, &ctx);
+}
+
+/* --- mtexp_parse_r() ---
+ * does the actual parsing, keeping all intermediate state in the
+ * context passed by the caller, thus it's safe to call it from
+ * multiple threads as long as they don't share contexts.
+ */
+struct ptree *mtexp_parse_r(const char *expr, struct parse_ctx *ctx) {
 	const char *eptr = expr - 1;
+	int nodes;
+
+	ctx->op_stack.top = ctx->arg_stack.top = 0;
+
+	/* every operand and operator of the expression becomes a tree node,
+	 * so count them beforehand and allocate the whole tree at once.
+	 */
+	if((nodes = count_nodes(ctx, expr)) == -1) {
+		fprintf(stderr, "expression too long (more than %d symbols)\n", STACK_SIZE);
+		return 0;
+	}
+	if(!nodes) {
+		fprintf(stderr, "empty expression\n");
+		return 0;
+	}
+	if(!(ctx->pool = malloc(nodes * sizeof *ctx->pool))) {
+		return 0;
+	}
+	ctx->pool_next = nodes;
 
 	while(*++eptr) {
 		struct symbol *symb;
@@ -84,9 +99,9 @@ struct ptree *mtexp_parse(const char *expr) {
 		if(isspace(*eptr)) continue;	/* eat up any whitespace */
 
 		/* get the next symbol (accepts only symbols in the symb_table[]) */
-		if(!(symb = match_symbol(eptr))) {
+		if(!(symb = match_symbol(ctx, eptr))) {
 			fprintf(stderr, "unexpected token: %s\n", eptr);
-			clean_stacks();
+			clean_stacks(ctx);
 			return 0;
 		}
 
@@ -97,99 +112,81 @@ struct ptree *mtexp_parse(const char *expr) {
 		switch(symb->type) {
 		case SYMB_TYPE_ARG:
 			/* if it is an operand, shift */
-			shift(symb);
+			shift(ctx, symb);
 			break;
 
 		case SYMB_TYPE_OP:
-			/* if it is an operator, then if the operator stack is 
+			/* if it is an operator, then while the operator stack is
 			 * not empty and the operator on the top of it has higher
-			 * precedence than the new one, then reduce first then shift
-			 * the new operator. Otherwise just shift.
+			 * precedence than the new one, reduce, then shift the new
+			 * operator.
 			 *
 			 * note: the >= comparison implies left-associativity for all operators
 			 * of equal precedence.
 			 */
-			if(SSIZE(op_stack) > 0 && TOP(op_stack).val.precedence >= symb->val.precedence) {
-				/* The parser tries to be smart here, if the two arguments that
-				 * are going to be used during reduce() are both textures, then
-				 * we will have a problem during the texture unit setup, as we can't
-				 * have two textures as source arguments on the same unit, so we reduce
-				 * only if the two arguments on the stack are not both textures
-				 */
-				int a1, a2;
-				a1 = arg_stack.stack[arg_stack.top - 1]->symb.symb;
-				a2 = arg_stack.stack[arg_stack.top - 2]->symb.symb;
-
-				if(!(a1 >= SYMB_T0 && a1 <= SYMB_T3) || !(a2 >= SYMB_T0 && a2 <= SYMB_T3)) {
-					if(reduce() == -1) {
-						fprintf(stderr, "reduce failed, argument stack underflow\n");
-						clean_stacks();
-						return 0;
-					}
+			while(SSIZE(ctx->op_stack) > 0 && TOP(ctx->op_stack).val.precedence >= symb->val.precedence) {
+				if(reduce(ctx) == -1) {
+					clean_stacks(ctx);
+					return 0;
 				}
 			}
-			shift(symb);
+			shift(ctx, symb);
 			break;
 
 		case SYMB_TYPE_PAREN:
 			if(symb->symb == SYMB_OPEN) {
 				/* if it is an opening parenthesis, shift */
-				shift(symb);
+				shift(ctx, symb);
 			} else {
 				/* keep reducing until we reach the openning parenthesis */
-				while(TOP(op_stack).symb != SYMB_OPEN) {
-					if(reduce() == -1) {
-						fprintf(stderr, "reduce failed, argument stack underflow\n");
-						clean_stacks();
+				while(TOP(ctx->op_stack).symb != SYMB_OPEN) {
+					if(reduce(ctx) == -1) {
+						clean_stacks(ctx);
 						return 0;
 					}
 
-					if(SSIZE(op_stack) < 1) {
+					if(SSIZE(ctx->op_stack) < 1) {
 						fprintf(stderr, "parenthesis mismatch (more close than open)\n");
-						clean_stacks();
+						clean_stacks(ctx);
 						return 0;
 					}
 				}
 
 				/* discard the matching openning parenthesis */
-				POP(op_stack);
+				POP(ctx->op_stack);
 			}
 			break;
 
 		default:
 			fprintf(stderr, "warning, unexpected symbol while parsing\n");
-			clean_stacks();
+			clean_stacks(ctx);
 			return 0;
 		}
 	}
 
 	/* reduce like there's no tomorrow */
-	while(SSIZE(op_stack)) {
-		if(reduce() == -1) {
-			fprintf(stderr, "reduce failed, argument stack underflow\n");
-			clean_stacks();
+	while(SSIZE(ctx->op_stack)) {
+		if(reduce(ctx) == -1) {
+			clean_stacks(ctx);
 			return 0;
 		}
 	}
 
-	if(SSIZE(op_stack) != 0 || SSIZE(arg_stack) != 1) {
+	if(SSIZE(ctx->op_stack) != 0 || SSIZE(ctx->arg_stack) != 1) {
 		fprintf(stderr, "parse tree creation failed, inconsistent stack state\n");
-		fprintf(stderr, "op stack: %d\targ stack: %d\n", SSIZE(op_stack), SSIZE(arg_stack));
-		clean_stacks();
+		fprintf(stderr, "op stack: %d\targ stack: %d\n", SSIZE(ctx->op_stack), SSIZE(ctx->arg_stack));
+		clean_stacks(ctx);
 		return 0;
 	}
 
-	return POP(arg_stack);
+	return POP(ctx->arg_stack);
 }
 
 /* --- mtexp_free_ptree() ---
- * destroyes an expression tree
+ * destroyes an expression tree, nodes are allocated back to front from
+ * a single block, so the root (always created last) is at its start.
  */
 void mtexp_free_ptree(struct ptree *t) {
-	if(!t) return;
-
-	mtexp_free_ptree(t->left);
-	mtexp_free_ptree(t->right);
 	free(t);
 }
 
@@ -198,101 +195,116 @@ void mtexp_free_ptree(struct ptree *t) {
  * Useful mainly for debugging purposes.
  */
 void mtexp_show_ptree(struct ptree *t) {
-	static int lvl = -1;
+	show_ptree(t, 0);
+}
+
+static void show_ptree(struct ptree *t, int lvl) {
 	int i;
 
 	if(t) {
-		lvl++;
-
 		for(i=0; i<lvl; i++) fputs("   ", stdout);
 		if(lvl) fputs("|- ", stdout);
-		puts(t->symb.str);
-
-		mtexp_show_ptree(t->left);
-		mtexp_show_ptree(t->right);
+		if(t->symb.symb >= SYMB_T0) {
+			printf("%s%d\n", t->symb.str, t->symb.symb - SYMB_T0);
+		} else {
+			puts(t->symb.str);
+		}
 
-		lvl--;
+		show_ptree(t->left, lvl + 1);
+		show_ptree(t->right, lvl + 1);
 	}
 }
 
 /* --- shift() ---
  * pushes the symbol into the appropriate stack
  */
-static void shift(struct symbol *s) {
+static void shift(struct parse_ctx *ctx, struct symbol *s) {
 	if(s->type == SYMB_TYPE_ARG) {
-		PUSH(arg_stack, make_ptree(s, 0, 0));
+		PUSH(ctx->arg_stack, make_ptree(ctx, s, 0, 0));
 	} else {
-		PUSH(op_stack, *s);
+		PUSH(ctx->op_stack, *s);
 	}
 }
 
 /* --- reduce() ---
  * pops an operator from the operator stack and the appropriate
  * number of operands from the argument stack, makes a tree out of
- * them and pushes it back in the argument stack.
+ * them and pushes it back in the argument stack. Returns -1, after
+ * saying why, if the expression doesn't make sense.
  *
  * note: at this point all operators are binary, so it always gets
  * two arguments from the stack.
  */
-static int reduce(void) {
+static int reduce(struct parse_ctx *ctx) {
 	struct symbol op;
-	struct ptree *a1, *a2;
+	struct ptree *a1, *a2, *t;
 
-	if(SSIZE(arg_stack) < 2) return -1;
+	/* an opening parenthesis left on the stack was never closed */
+	if(TOP(ctx->op_stack).symb == SYMB_OPEN) {
+		fprintf(stderr, "parenthesis mismatch (more open than close)\n");
+		return -1;
+	}
+	if(SSIZE(ctx->arg_stack) < 2) {
+		fprintf(stderr, "reduce failed, argument stack underflow\n");
+		return -1;
+	}
 
-	op = POP(op_stack);
-	a2 = POP(arg_stack);
-	a1 = POP(arg_stack);
+	op = POP(ctx->op_stack);
+	a2 = POP(ctx->arg_stack);
+	a1 = POP(ctx->arg_stack);
 
-	PUSH(arg_stack, make_ptree(&op, a1, a2));
+	if(!(t = make_ptree(ctx, &op, a1, a2))) {
+		fprintf(stderr, "reduce failed, out of tree nodes\n");
+		return -1;
+	}
+	PUSH(ctx->arg_stack, t);
 	return 0;
 }
 
 
-static void clean_stacks(void) {
-	while(SSIZE(arg_stack)) {
-		struct ptree *t = POP(arg_stack);
-		mtexp_free_ptree(t);
-	}
+static void clean_stacks(struct parse_ctx *ctx) {
+	free(ctx->pool);
+	ctx->pool = 0;
 
-	op_stack.top = 0;
+	ctx->arg_stack.top = ctx->op_stack.top = 0;
 }
 
 
 /* --- match_symbol() ---
  * tries to match the beginning of the passed string to any symbol of
- * the symbol table, and returns the correspondence.
+ * the symbol table, and returns the correspondence. The returned
+ * pointer points to the scratch symbol of the parser context.
  */
-static struct symbol *match_symbol(const char *str) {
-	static struct symbol s;
+static struct symbol *match_symbol(struct parse_ctx *ctx, const char *str) {
+	struct symbol *s = &ctx->match;
 	int i;
 
 	if(isdigit(*str)) {
-		s = symb_table[SYMB_NUM];
-		s.val.value[0] = s.val.value[1] = s.val.value[2] = s.val.value[3] = atof(str);
-		return &s;
+		*s = symb_table[SYMB_NUM];
+		s->val.value[0] = s->val.value[1] = s->val.value[2] = s->val.value[3] = atof(str);
+		return s;
 	}
 
 	if(*str == '<') {
-		s = symb_table[SYMB_NUM];
+		*s = symb_table[SYMB_NUM];
 
 		if(!isdigit(*++str)) return 0;
-		s.val.value[0] = atof(str);
+		s->val.value[0] = atof(str);
 		while(isdigit(*str) || *str == '.') str++;
 		while(isspace(*str) || *str == ',') str++;
 
 		for(i=1; i<4; i++) {
 			if(!isdigit(*str)) {
-				s.val.value[i] = i < 3 ? s.val.value[i - 1] : 1.0f;
+				s->val.value[i] = i < 3 ? s->val.value[i - 1] : 1.0f;
 			} else {
-				s.val.value[i] = atof(str);
+				s->val.value[i] = atof(str);
 			}
 			while(isdigit(*str) || *str == '.') str++;
 			while(isspace(*str) || *str == ',') str++;
 		}
 
 		if(*str != '>') return 0;
-		return &s;
+		return s;
 	}
 
 
@@ -309,14 +321,34 @@ static struct symbol *match_symbol(const char *str) {
 		}
 
 		if(!*symb) {
-			s = symb_table[i];
-			return &s;
+			*s = symb_table[i];
+			if(i == SYMB_T0 && !match_texture(s, strptr)) return 0;
+			return s;
 		}
 	}
 
 	return 0;
 }
 
+/* --- match_texture() ---
+ * completes a texture symbol with the slot number following the 't',
+ * returns 0 if there is no valid one.
+ */
+static int match_texture(struct symbol *s, const char *str) {
+	long n;
+
+	if(!isdigit(*str)) return 0;
+
+	n = 0;
+	while(isdigit(*str)) {
+		n = n * 10 + *str++ - '0';
+		if(n > MAX_TEX_INDEX) return 0;
+	}
+
+	s->symb = SYMB_T0 + (int)n;
+	return 1;
+}
+
 /* --- consume() ---
  * consumes the appropriate ammount of characters for the specified symbol
  * from the expression string and returns the position of the new pointer.
@@ -331,6 +363,8 @@ static const char *consume(int symb, const char *eptr) {
 			while(isdigit(*eptr) || (*eptr == '.' && !dots_eaten++)) eptr++;
 			eptr--;
 		}
+	} else if(symb >= SYMB_T0) {
+		while(isdigit(eptr[1])) eptr++;
 	} else {
 		const char *str = symb_table[symb].str + 1;
 		while(*str++) eptr++;
@@ -339,12 +373,38 @@ static const char *consume(int symb, const char *eptr) {
 }
 
 
-static struct ptree *make_ptree(struct symbol *s, struct ptree *left, struct ptree *right) {
-	struct ptree *t = malloc(sizeof(struct ptree));
-	if(t) {
-		t->symb = *s;
-		t->left = left;
-		t->right = right;
+/* --- count_nodes() ---
+ * tokenizes the expression and returns the number of operands and
+ * operators in it, or -1 if it has more symbols than the parser stacks
+ * can hold. Stops silently at the first invalid token, the parser proper
+ * will complain about it.
+ */
+static int count_nodes(struct parse_ctx *ctx, const char *expr) {
+	const char *eptr = expr - 1;
+	int nodes = 0, symbols = 0;
+
+	while(*++eptr) {
+		struct symbol *symb;
+
+		if(isspace(*eptr)) continue;
+		if(!(symb = match_symbol(ctx, eptr))) break;
+		eptr = consume(symb->symb, eptr);
+
+		if(++symbols > STACK_SIZE) return -1;
+		if(symb->type != SYMB_TYPE_PAREN) nodes++;
 	}
+	return nodes;
+}
+
+static struct ptree *make_ptree(struct parse_ctx *ctx, struct symbol *s, struct ptree *left, struct ptree *right) {
+	struct ptree *t;
+
+	/* all the nodes count_nodes() found are taken */
+	if(ctx->pool_next <= 0) return 0;
+	t = ctx->pool + --ctx->pool_next;
+
+	t->symb = *s;
+	t->left = left;
+	t->right = right;
 	return t;
 }
@@ -22,22 +22,30 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
-#define MAX_TEXTURES	4
-
-/* possible symbols in the expression */
+/* render to texture temporaries of a compiled expression, taking the
+ * texture slots following the ones of the expression.
+ */
+#define MAX_TEMPS		4
+
+/* highest N accepted for a texture reference tN. Slots are 16 bit
+ * instruction arguments (see program.h), with room left after the
+ * expression for a baked slot and the temporaries.
+ */
+#define MAX_TEX_INDEX	(65535 - 1 - MAX_TEMPS)
+
+/* possible symbols in the expression. Textures come last, the symbol of
+ * texture slot N is SYMB_T0 + N.
+ */
 enum {
 	SYMB_PLUS,		/* + */
 	SYMB_MINUS,		/* - */
 	SYMB_MUL,		/* * */
 	SYMB_DOT,		/* . (dot product) */
 	SYMB_COL,		/* c */
-	SYMB_T0,		/* t0 */
-	SYMB_T1,		/* t1 */
-	SYMB_T2,		/* t2 */
-	SYMB_T3,		/* t3 */
 	SYMB_OPEN,		/* ( */
 	SYMB_CLOSE,		/* ) */
-	SYMB_NUM		/* a constant */
+	SYMB_NUM,		/* a constant */
+	SYMB_T0			/* t0, followed by the rest of the tN */
 };
 
 /* symbol types (operator, argument, parenthesis) */
@@ -61,6 +69,30 @@ struct ptree {
 	struct ptree *left, *right;
 };
 
+/* parser context, holds all the state of a single parse so that
+ * several expressions may be parsed concurrently (one context each).
+ */
+#define STACK_SIZE	100
+
+struct parse_ctx {
+	/* operator and operand (argument) stacks */
+	struct symb_stack {
+		struct symbol stack[STACK_SIZE];
+		int top;
+	} op_stack;
+
+	struct tree_stack {
+		struct ptree *stack[STACK_SIZE];
+		int top;
+	} arg_stack;
+
+	struct symbol match;	/* scratch symbol returned by the tokenizer */
+
+	/* all the nodes of the tree are allocated from this block */
+	struct ptree *pool;
+	int pool_next;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif	/* __cplusplus */
@@ -68,7 +100,14 @@ extern "C" {
 /* parses the expression and returns the expression tree */
 struct ptree *mtexp_parse(const char *expr);
 
-/* destroyes an expression tree */
+/* reentrant version of mtexp_parse, uses the caller supplied context
+ * for all intermediate state.
+ */
+struct ptree *mtexp_parse_r(const char *expr, struct parse_ctx *ctx);
+
+/* destroyes an expression tree (returned by mtexp_parse, the whole tree
+ * lives in a single block of memory starting at the root node).
+ */
 void mtexp_free_ptree(struct ptree *t);
 
 /* outputs the expression tree to stdout (for debugging mainly) */
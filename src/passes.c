@@ -0,0 +1,313 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "passes.h"
+#include "schedule.h"
+#include "optimize.h"
+
+#define IS_OP(t)		((t)->symb.type == SYMB_TYPE_OP)
+#define IS_SHARED(t)	(IS_OP(t) && (t)->left == (t)->right)
+
+/* subtree that may move to a temporary, and where it hangs from */
+struct candidate {
+	struct ptree *t, *parent;
+	int size;
+};
+
+struct planner {
+	unsigned int flags;
+	int max_units;
+	struct pass_step *step;
+	int count, max_steps;
+	int temp_base, temps;
+	struct ptree leaf[MAX_TEMPS];	/* the temporaries, as they appear in the tree */
+};
+
+static void flatten(struct ptree *t, int op, struct ptree **opnd, int *nopnd, struct ptree **node, int *nnode);
+static void rechain(struct ptree **opnd, int nopnd, struct ptree **node);
+static struct program *try_pass(struct ptree **opnd, const int *pass, int count, int p,
+		struct ptree **node, unsigned int flags, int max_units);
+static int plan_tree(struct planner *pl, struct ptree *tree, int temp, struct sched_cost *cost);
+static int add_passes(struct planner *pl, struct ptree *tree, int temp, int max_passes, struct sched_cost *cost);
+static void make_temp(struct planner *pl, const struct candidate *c);
+static int collect(struct ptree *t, struct ptree *parent, struct candidate *cand, int *count);
+static int max_slot(const struct ptree *t);
+
+/* --- mtexp_split_passes() ---
+ * Framebuffer blending can only add or multiply, so only the operands of
+ * a + or * at the root of the tree can go to different passes. The
+ * operands of the whole chain of that operator are collected, and each
+ * one joins the first pass it still fits in, or else starts a new one.
+ */
+int mtexp_split_passes(struct ptree *tree, unsigned int flags, int max_units,
+		struct program **prog, int *blend, int max_passes, struct sched_cost *cost) {
+	struct ptree *opnd[STACK_SIZE], *node[STACK_SIZE];
+	struct program *p;
+	int pass[STACK_SIZE];
+	int i, j, op, nopnd = 0, nnode = 0, count = 0;
+
+	if(!(p = mtexp_schedule(tree, flags, max_units, cost))) {
+		return 0;
+	}
+	if(cost->fits) {
+		prog[0] = p;
+		blend[0] = PASS_REPLACE;
+		return 1;
+	}
+	mtexp_free_program(p);
+
+	op = tree->symb.symb;
+	if(max_passes < 2 || !IS_OP(tree) || IS_SHARED(tree) || (op != SYMB_PLUS && op != SYMB_MUL)) {
+		return 0;
+	}
+	flatten(tree, op, opnd, &nopnd, node, &nnode);
+
+	for(j=0; j<nopnd; j++) {
+		/* a scale factor applies to the whole product, not to one pass */
+		if(op == SYMB_MUL && mtexp_scale_factor(opnd[j])) break;
+
+		for(i=0; i<=count && i<max_passes; i++) {
+			pass[j] = i;
+			if((p = try_pass(opnd, pass, j + 1, i, node, flags, max_units))) break;
+		}
+		if(!p) break;
+
+		if(i < count) {
+			mtexp_free_program(prog[i]);
+		} else {
+			blend[count++] = op == SYMB_PLUS ? PASS_ADD : PASS_MODULATE;
+		}
+		prog[i] = p;
+	}
+
+	if(j < nopnd) {
+		for(i=0; i<count; i++) {
+			mtexp_free_program(prog[i]);
+		}
+		rechain(opnd, nopnd, node);
+		return 0;
+	}
+	blend[0] = PASS_REPLACE;
+	return count;
+}
+
+/* --- mtexp_plan_passes() ---
+ * A temporary costs a copy of the framebuffer on top of its passes, so
+ * they're only used when splitting the expression at its root isn't
+ * enough. The subtree moved to a temporary is the largest one that can
+ * be split in passes by itself, leaving the least to the rest.
+ */
+int mtexp_plan_passes(struct ptree *tree, unsigned int flags, int max_units,
+		struct pass_step *step, int max_steps, int *temp_base, struct sched_cost *cost) {
+	struct planner pl;
+	int i;
+
+	pl.flags = flags;
+	pl.max_units = max_units;
+	pl.step = step;
+	pl.count = 0;
+	pl.max_steps = max_steps;
+	pl.temp_base = *temp_base = max_slot(tree) + 1;
+	pl.temps = 0;
+
+	if(plan_tree(&pl, tree, -1, cost) == -1) {
+		for(i=0; i<pl.count; i++) {
+			mtexp_free_program(step[i].prog);
+		}
+		return 0;
+	}
+	return pl.count;
+}
+
+/* adds the passes of a tree rendering to temp, with the passes of any
+ * temporaries it needs before them.
+ */
+static int plan_tree(struct planner *pl, struct ptree *tree, int temp, struct sched_cost *cost) {
+	struct candidate cand[STACK_SIZE], tmp;
+	struct sched_cost sub_cost;
+	int i, j, count, room, idx, first = 1;
+
+	for(;;) {
+		/* the cost returned is the one of the tree as it was given */
+		room = pl->max_steps - pl->count;
+		if(add_passes(pl, tree, temp, room, first ? cost : &sub_cost) != -1) {
+			return 0;
+		}
+		first = 0;
+
+		if(pl->temps >= MAX_TEMPS || room < 2) {
+			return -1;
+		}
+
+		/* largest subtrees first */
+		count = 0;
+		collect(tree, 0, cand, &count);
+		if(!count) return -1;
+
+		for(i=1; i<count; i++) {
+			tmp = cand[i];
+			for(j=i; j>0 && cand[j - 1].size < tmp.size; j--) {
+				cand[j] = cand[j - 1];
+			}
+			cand[j] = tmp;
+		}
+
+		for(i=0; i<count; i++) {
+			/* leave a pass for the rest of the tree */
+			if(add_passes(pl, cand[i].t, pl->temps, room - 1, &sub_cost) != -1) break;
+		}
+
+		idx = pl->temps;
+		if(i < count) {
+			make_temp(pl, cand + i);
+		} else {
+			/* nothing fits as it is, the largest one needs temporaries too */
+			make_temp(pl, cand);
+			if(plan_tree(pl, cand[0].t, idx, &sub_cost) == -1) {
+				return -1;
+			}
+		}
+	}
+}
+
+/* schedules a tree in up to max_passes passes, and appends them */
+static int add_passes(struct planner *pl, struct ptree *tree, int temp, int max_passes, struct sched_cost *cost) {
+	struct program *prog[MAX_PASSES];
+	int i, blend[MAX_PASSES], count;
+
+	if(max_passes > MAX_PASSES) max_passes = MAX_PASSES;
+
+	if(max_passes < 1 || !(count = mtexp_split_passes(tree, pl->flags, pl->max_units, prog, blend, max_passes, cost))) {
+		return -1;
+	}
+
+	for(i=0; i<count; i++) {
+		pl->step[pl->count].prog = prog[i];
+		pl->step[pl->count].blend = blend[i];
+		pl->step[pl->count++].temp = temp;
+	}
+	return 0;
+}
+
+/* replaces a subtree with the next temporary */
+static void make_temp(struct planner *pl, const struct candidate *c) {
+	struct ptree *leaf = pl->leaf + pl->temps;
+
+	leaf->symb.symb = SYMB_T0 + pl->temp_base + pl->temps++;
+	leaf->symb.type = SYMB_TYPE_ARG;
+	leaf->symb.str = "temp";
+	leaf->left = leaf->right = 0;
+
+	/* both operands of a shared operator are the same node */
+	if(c->parent->left == c->t) c->parent->left = leaf;
+	if(c->parent->right == c->t) c->parent->right = leaf;
+}
+
+/* collects the operator subtrees below the root, returns the size of t */
+static int collect(struct ptree *t, struct ptree *parent, struct candidate *cand, int *count) {
+	int size;
+
+	if(!IS_OP(t)) return 1;
+
+	if(IS_SHARED(t)) {
+		size = 2 * collect(t->left, t, cand, count) + 1;
+	} else {
+		size = collect(t->left, t, cand, count) + collect(t->right, t, cand, count) + 1;
+	}
+
+	if(parent) {
+		cand[*count].t = t;
+		cand[*count].parent = parent;
+		cand[(*count)++].size = size;
+	}
+	return size;
+}
+
+/* highest texture slot used by a tree, -1 for none */
+static int max_slot(const struct ptree *t) {
+	int l, r;
+
+	if(!t) return -1;
+	if(!IS_OP(t)) {
+		return t->symb.symb >= SYMB_T0 ? t->symb.symb - SYMB_T0 : -1;
+	}
+	l = max_slot(t->left);
+	r = max_slot(t->right);
+	return l > r ? l : r;
+}
+
+/* collects the operands of a chain of the same operator, and the
+ * operator nodes themselves, to be reused by the passes.
+ */
+static void flatten(struct ptree *t, int op, struct ptree **opnd, int *nopnd, struct ptree **node, int *nnode) {
+	if(IS_OP(t) && !IS_SHARED(t) && t->symb.symb == op) {
+		node[(*nnode)++] = t;
+		flatten(t->left, op, opnd, nopnd, node, nnode);
+		flatten(t->right, op, opnd, nopnd, node, nnode);
+	} else {
+		opnd[(*nopnd)++] = t;
+	}
+}
+
+/* puts a chain taken apart by the passes back together, with its root
+ * operator at the top again.
+ */
+static void rechain(struct ptree **opnd, int nopnd, struct ptree **node) {
+	struct ptree *t = opnd[0];
+	int i;
+
+	for(i=1; i<nopnd; i++) {
+		struct ptree *n = node[nopnd - 1 - i];
+
+		n->left = t;
+		n->right = opnd[i];
+		t = n;
+	}
+}
+
+/* builds the tree of pass p out of the first count operands, and returns
+ * its program if it fits in the units, null otherwise.
+ */
+static struct program *try_pass(struct ptree **opnd, const int *pass, int count, int p,
+		struct ptree **node, unsigned int flags, int max_units) {
+	struct ptree *t = 0;
+	struct program *prog;
+	struct sched_cost cost;
+	int i, n = 0;
+
+	for(i=0; i<count; i++) {
+		if(pass[i] != p) continue;
+
+		if(!t) {
+			t = opnd[i];
+		} else {
+			node[n]->left = t;
+			node[n]->right = opnd[i];
+			t = node[n++];
+		}
+	}
+
+	if((prog = mtexp_schedule(t, flags, max_units, &cost)) && !cost.fits) {
+		mtexp_free_program(prog);
+		prog = 0;
+	}
+	return prog;
+}
@@ -0,0 +1,78 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _PASSES_H_
+#define _PASSES_H_
+
+#include "parser.h"
+#include "program.h"
+#include "schedule.h"
+
+/* Multipass decomposition: an expression that doesn't fit in the
+ * available texture units is split into passes, each rendered with the
+ * units to itself, and accumulated in the framebuffer by blending.
+ */
+
+#define MAX_PASSES	16
+
+/* a rendering pass, with the temporary texture it renders, if any */
+struct pass_step {
+	struct program *prog;
+	int blend;		/* PASS_* blending with the passes before it */
+	int temp;		/* temporary it's part of, -1 for the result */
+};
+
+/* how a pass is combined with the result of the passes before it */
+enum {
+	PASS_REPLACE,	/* first pass, blending is left alone */
+	PASS_ADD,		/* glBlendFunc(GL_ONE, GL_ONE) */
+	PASS_MODULATE	/* glBlendFunc(GL_DST_COLOR, GL_ZERO) */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* schedules the tree in as few passes as possible. The programs of the
+ * passes and their PASS_* blending are returned through prog and blend,
+ * which must have room for max_passes (at most MAX_PASSES) each. The
+ * tree is rearranged in the process. Returns the number of passes, or 0
+ * if the expression can't be split to fit, with the cost of running it
+ * in a single pass returned through cost.
+ */
+int mtexp_split_passes(struct ptree *tree, unsigned int flags, int max_units,
+		struct program **prog, int *blend, int max_passes, struct sched_cost *cost);
+
+/* schedules the tree in up to max_steps passes like mtexp_split_passes,
+ * and if that's not enough, moves subtrees to render to texture
+ * temporaries (up to MAX_TEMPS), read as the texture slots after the ones
+ * of the expression. The passes of each temporary come before the ones
+ * reading it. temp_base returns the first temporary slot. Returns the
+ * number of passes, or 0 if the expression can't be rendered.
+ */
+int mtexp_plan_passes(struct ptree *tree, unsigned int flags, int max_units,
+		struct pass_step *step, int max_steps, int *temp_base, struct sched_cost *cost);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _PASSES_H_ */
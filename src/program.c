@@ -0,0 +1,425 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "program.h"
+#include "optimize.h"
+
+#define IS_OP(t)	((t)->symb.type == SYMB_TYPE_OP)
+#define IS_CONST(t)	((t)->symb.symb == SYMB_NUM)
+#define IS_TEX(t)	((t)->symb.symb >= SYMB_T0)
+
+static void count_nodes(const struct ptree *t, unsigned int flags, int *ops, int *consts, int *texs);
+static int lower(struct program *prog, const struct ptree *t);
+static int match_scale(const struct ptree *t, const struct ptree **opnd);
+static int match_lerp(const struct program *prog, const struct ptree *t, const struct ptree **opnd);
+static int match_add_signed(const struct program *prog, const struct ptree *t, const struct ptree **opnd);
+static int match_modulate_add(const struct program *prog, const struct ptree *t, const struct ptree **opnd);
+static int complement(const struct program *prog, const struct ptree *k, const struct ptree *nk);
+static int fits_unit(const struct program *prog, const struct ptree **opnd, int count);
+static int is_value(const struct program *prog, const struct ptree *t, float val);
+static int emit(struct program *prog, int op, const struct ptree **opnd, const int *res, int count);
+static void set_source(struct program *prog, struct instr *in, int i, const struct ptree *t, int res);
+static int two_textures(const struct ptree *a, const struct ptree *b);
+static int two_colors(const struct ptree *a, const struct ptree *b, unsigned int flags);
+
+/* --- mtexp_compile() ---
+ * lowers the expression tree to a flat postfix program, allocated as
+ * a single block together with its constant table.
+ */
+struct program *mtexp_compile(const struct ptree *tree, unsigned int flags) {
+	struct program *prog;
+	int ops = 0, consts = 0, texs = 0;
+
+	count_nodes(tree, flags, &ops, &consts, &texs);
+	if(!ops) ops = 1;	/* a lone operand is passed through by a replace */
+
+	prog = malloc(sizeof *prog + consts * sizeof *prog->consts + ops * sizeof *prog->code);
+	if(!prog) return 0;
+
+	prog->consts = (float (*)[4])(prog + 1);
+	prog->code = (struct instr*)(prog->consts + consts);
+	prog->count = prog->const_count = 0;
+	prog->tex_count = texs;
+	prog->flags = flags;
+
+	if(lower(prog, tree) == -1) {
+		int res = -1;
+		emit(prog, OP_REPLACE, &tree, &res, 1);
+	}
+	return prog;
+}
+
+void mtexp_free_program(struct program *prog) {
+	free(prog);
+}
+
+/* --- mtexp_is_chain() ---
+ * checks that the program can be mapped to a texture unit cascade,
+ * where the only result available to a unit is the one of the unit
+ * right before it (GL_PREVIOUS).
+ */
+int mtexp_is_chain(const struct program *prog) {
+	int i, j;
+
+	for(i=0; i<prog->count; i++) {
+		const struct instr *in = prog->code + i;
+
+		/* both sources may be GL_PREVIOUS, if they're the same result */
+		for(j=0; j<MAX_SOURCES; j++) {
+			if(in->src[j] == SRC_PREV && in->arg[j] != i - 1) return 0;
+		}
+	}
+	return 1;
+}
+
+static void count_nodes(const struct ptree *t, unsigned int flags, int *ops, int *consts, int *texs) {
+	if(!t) return;
+
+	if(t->symb.type == SYMB_TYPE_OP) {
+		int split = two_textures(t->left, t->right) || two_colors(t->left, t->right, flags);
+		*ops += split ? 2 : 1;
+	} else if(t->symb.symb == SYMB_NUM) {
+		(*consts)++;
+	} else if(t->symb.symb != SYMB_COL) {
+		/* textures are numbered by their slot, no matter how many times
+		 * each of them is used, or if some slots are left unused.
+		 */
+		int slots = t->symb.symb - SYMB_T0 + 1;
+		if(slots > *texs) *texs = slots;
+	}
+	count_nodes(t->left, flags, ops, consts, texs);
+	if(t->right != t->left) {
+		count_nodes(t->right, flags, ops, consts, texs);
+	}
+}
+
+/* --- lower() ---
+ * emits the instructions of a subtree in postfix order, returns the
+ * index of the instruction computing its result, or -1 if the subtree
+ * is a single operand. Patterns of operators which a single combiner
+ * function can compute are fused into one instruction on the way.
+ */
+static int lower(struct program *prog, const struct ptree *t) {
+	const struct ptree *opnd[MAX_SOURCES];
+	int i, op, res[MAX_SOURCES], count = 2, scale;
+
+	if(!IS_OP(t)) return -1;
+
+	if((scale = match_scale(t, opnd))) {
+		op = OP_REPLACE;
+		count = 1;
+	} else if(match_lerp(prog, t, opnd)) {
+		op = OP_INTERPOLATE;
+		count = 3;
+	} else if((prog->flags & PROG_MODULATE_ADD) && (op = match_modulate_add(prog, t, opnd)) != -1) {
+		count = 3;
+	} else if(match_add_signed(prog, t, opnd)) {
+		op = OP_ADD_SIGNED;
+	} else {
+		op = t->symb.symb - SYMB_PLUS + OP_ADD;
+		opnd[0] = t->left;
+		opnd[1] = t->right;
+	}
+
+	for(i=0; i<count; i++) {
+		/* a subtree shared by both operands is computed once */
+		res[i] = i > 0 && opnd[i] == opnd[i - 1] ? res[i - 1] : lower(prog, opnd[i]);
+	}
+
+	if(scale) {
+		/* x * 2 and x * 4 scale the output of the unit computing x. Doing
+		 * that before saturation gives the same result, since saturating
+		 * in between never turns a value below 1 into one above it.
+		 */
+		if(res[0] >= 0 && prog->code[res[0]].scale * scale <= 4) {
+			prog->code[res[0]].scale *= scale;
+			return res[0];
+		}
+		i = emit(prog, OP_REPLACE, opnd, res, 1);
+		prog->code[i].scale = scale;
+		return i;
+	}
+	return emit(prog, op, opnd, res, count);
+}
+
+/* x * 2, x * 4 */
+static int match_scale(const struct ptree *t, const struct ptree **opnd) {
+	int scale;
+
+	if(t->symb.symb != SYMB_MUL || t->left == t->right) return 0;
+
+	if((scale = mtexp_scale_factor(t->right))) {
+		opnd[0] = t->left;
+	} else if((scale = mtexp_scale_factor(t->left))) {
+		opnd[0] = t->right;
+	}
+	return scale;
+}
+
+/* --- match_lerp() ---
+ * a * k + b * (1 - k) in any order of operands, where 1 - k is either
+ * written out, or the complement of a constant k. The result can't
+ * exceed 1, so GL_INTERPOLATE gives exactly the same result as the
+ * operators it replaces.
+ */
+static int match_lerp(const struct program *prog, const struct ptree *t, const struct ptree **opnd) {
+	const struct ptree *ma, *mb, *k, *nk;
+	int i, j, l;
+
+	if(t->symb.symb != SYMB_PLUS || t->left == t->right) return 0;
+
+	for(i=0; i<2; i++) {
+		ma = i ? t->right : t->left;
+		if(ma->symb.symb != SYMB_MUL || ma->left == ma->right) return 0;
+	}
+
+	for(i=0; i<2; i++) {
+		ma = i ? t->right : t->left;
+		mb = i ? t->left : t->right;
+
+		for(j=0; j<2; j++) {
+			k = j ? ma->left : ma->right;
+
+			for(l=0; l<2; l++) {
+				nk = l ? mb->left : mb->right;
+
+				if(complement(prog, k, nk)) {
+					opnd[0] = j ? ma->right : ma->left;
+					opnd[1] = l ? mb->right : mb->left;
+					opnd[2] = k;
+					if(fits_unit(prog, opnd, 3)) return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* a + b - 0.5 and a - 0.5 + b. GL_ADD_SIGNED saturates only once, at the
+ * end, which is what this pattern is written for in the first place.
+ */
+static int match_add_signed(const struct program *prog, const struct ptree *t, const struct ptree **opnd) {
+	const struct ptree *sub;
+	int i;
+
+	if(t->left == t->right) return 0;
+
+	if(t->symb.symb == SYMB_MINUS) {
+		const struct ptree *sum = t->left;
+
+		if(sum->symb.symb == SYMB_PLUS && sum->left != sum->right && is_value(prog, t->right, 0.5f)) {
+			opnd[0] = sum->left;
+			opnd[1] = sum->right;
+			return 1;
+		}
+	} else if(t->symb.symb == SYMB_PLUS) {
+		for(i=0; i<2; i++) {
+			sub = i ? t->right : t->left;
+
+			if(sub->symb.symb == SYMB_MINUS && sub->left != sub->right && is_value(prog, sub->right, 0.5f)) {
+				opnd[0] = sub->left;
+				opnd[1] = i ? t->left : t->right;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* a * b + c and a * b + c - 0.5, returns the opcode or -1 */
+static int match_modulate_add(const struct program *prog, const struct ptree *t, const struct ptree **opnd) {
+	const struct ptree *sum[2], *mul;
+	int i, op = OP_MODULATE_ADD;
+
+	if(match_add_signed(prog, t, sum)) {
+		op = OP_MODULATE_SIGNED_ADD;
+	} else if(t->symb.symb == SYMB_PLUS && t->left != t->right) {
+		sum[0] = t->left;
+		sum[1] = t->right;
+	} else {
+		return -1;
+	}
+
+	for(i=0; i<2; i++) {
+		mul = sum[i];
+
+		/* x * 2 is a scale, which goes on the unit computing x */
+		if(mul->symb.symb != SYMB_MUL || mul->left == mul->right ||
+				mtexp_scale_factor(mul->left) || mtexp_scale_factor(mul->right)) {
+			continue;
+		}
+
+		opnd[0] = mul->left;
+		opnd[1] = mul->right;
+		opnd[2] = sum[1 - i];
+		if(fits_unit(prog, opnd, 3)) return op;
+	}
+	return -1;
+}
+
+/* checks if nk is 1 - k */
+static int complement(const struct program *prog, const struct ptree *k, const struct ptree *nk) {
+	int i, first = 0, last = 2;
+
+	if(IS_CONST(k) && IS_CONST(nk)) {
+		/* alpha programs only read the alpha of their constants */
+		if(prog->flags & PROG_ALPHA) first = last = 3;
+
+		for(i=first; i<=last; i++) {
+			float err = k->symb.val.value[i] + nk->symb.val.value[i] - 1.0f;
+			if(err < -1.0f / 512.0f || err > 1.0f / 512.0f) return 0;
+		}
+		return 1;
+	}
+
+	if(nk->symb.symb != SYMB_MINUS || nk->left == nk->right) return 0;
+	return is_value(prog, nk->left, 1.0f) && mtexp_same_tree(nk->right, k);
+}
+
+/* --- fits_unit() ---
+ * checks that a single unit can take all the operands of a fused
+ * instruction: one previous result, one texture and one constant at most.
+ * With the crossbar a unit can sample any number of textures.
+ */
+static int fits_unit(const struct program *prog, const struct ptree **opnd, int count) {
+	int i, j, ops = 0;
+
+	for(i=0; i<count; i++) {
+		if(IS_OP(opnd[i])) {
+			if(++ops > 1) return 0;
+			continue;
+		}
+
+		for(j=0; j<i; j++) {
+			const struct ptree *a = opnd[i], *b = opnd[j];
+
+			if(!(prog->flags & PROG_CROSSBAR) && two_textures(a, b)) return 0;
+			if(two_colors(a, b, prog->flags)) return 0;
+		}
+	}
+	return 1;
+}
+
+/* checks if the components of a constant the program reads (all color
+ * ones, or the alpha one) have the specified value
+ */
+static int is_value(const struct program *prog, const struct ptree *t, float val) {
+	const float *v = t->symb.val.value;
+
+	if(!IS_CONST(t)) return 0;
+	if(prog->flags & PROG_ALPHA) return v[3] == val;
+	return v[0] == val && v[1] == val && v[2] == val;
+}
+
+/* --- emit() ---
+ * appends an instruction, with the results of its operands in res
+ * (-1 for operands which are leaves).
+ */
+static int emit(struct program *prog, int op, const struct ptree **opnd, const int *res, int count) {
+	struct instr *in;
+	int i, prev = -1;
+
+	/* a unit can only sample one texture and has a single constant color,
+	 * so the left one is brought in by a unit of its own and the operator
+	 * works on the previous result.
+	 */
+	if(count == 2 && (two_colors(opnd[0], opnd[1], prog->flags) ||
+				(!(prog->flags & PROG_CROSSBAR) && two_textures(opnd[0], opnd[1])))) {
+		prev = emit(prog, OP_REPLACE, opnd, res, 1);
+	}
+
+	in = prog->code + prog->count;
+	in->op = op;
+	in->scale = 1;
+
+	for(i=0; i<MAX_SOURCES; i++) {
+		if(i < count) {
+			set_source(prog, in, i, opnd[i], i == 0 && prev >= 0 ? prev : res[i]);
+		} else {
+			in->src[i] = in->src[0];
+			in->arg[i] = in->arg[0];
+		}
+	}
+	return prog->count++;
+}
+
+static void set_source(struct program *prog, struct instr *in, int i, const struct ptree *t, int res) {
+	int j;
+	float *val;
+
+	if(res >= 0) {
+		in->src[i] = SRC_PREV;
+		in->arg[i] = res;
+		return;
+	}
+
+	switch(t->symb.symb) {
+	case SYMB_COL:
+		in->src[i] = SRC_COL;
+		in->arg[i] = 0;
+		break;
+
+	case SYMB_NUM:
+		/* each distinct constant is stored once in the table */
+		in->src[i] = SRC_CONST;
+		for(j=0; j<prog->const_count; j++) {
+			if(memcmp(prog->consts[j], t->symb.val.value, sizeof *prog->consts) == 0) break;
+		}
+		in->arg[i] = j;
+
+		if(j == prog->const_count) {
+			val = prog->consts[prog->const_count++];
+			val[0] = t->symb.val.value[0];
+			val[1] = t->symb.val.value[1];
+			val[2] = t->symb.val.value[2];
+			val[3] = t->symb.val.value[3];
+		}
+		break;
+
+	default:
+		in->src[i] = SRC_TEX;
+		in->arg[i] = t->symb.symb - SYMB_T0;
+	}
+}
+
+/* checks if both operands of an operator are different textures */
+static int two_textures(const struct ptree *a, const struct ptree *b) {
+	return IS_TEX(a) && IS_TEX(b) && a->symb.symb != b->symb.symb;
+}
+
+/* checks if both operands are constants with different colors, which
+ * can't share the constant color of a unit. Alpha programs only read
+ * the alpha of the constant color.
+ */
+static int two_colors(const struct ptree *a, const struct ptree *b, unsigned int flags) {
+	const float *va, *vb;
+
+	if(!IS_CONST(a) || !IS_CONST(b)) return 0;
+	va = a->symb.val.value;
+	vb = b->symb.val.value;
+
+	if(flags & PROG_ALPHA) {
+		return va[3] != vb[3];
+	}
+	return va[0] != vb[0] || va[1] != vb[1] || va[2] != vb[2];
+}
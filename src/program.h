@@ -0,0 +1,110 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+
+#include "parser.h"
+
+/* instruction opcodes, same order as the operator symbols */
+enum {
+	OP_ADD,		/* + */
+	OP_SUB,		/* - */
+	OP_MUL,		/* * */
+	OP_DOT,		/* . (dot product) */
+	OP_REPLACE,	/* passes its first source through */
+
+	/* fused operators, matched from several operators of the tree */
+	OP_INTERPOLATE,	/* a * k + b * (1 - k) */
+	OP_ADD_SIGNED,	/* a + b - 0.5 */
+	OP_MODULATE_ADD,		/* a * b + c */
+	OP_MODULATE_SIGNED_ADD	/* a * b + c - 0.5 */
+};
+
+/* optional instructions the target can run, the rest are always there,
+ * and the channel the program computes.
+ */
+enum {
+	PROG_MODULATE_ADD	= 1,	/* OP_MODULATE_ADD, OP_MODULATE_SIGNED_ADD */
+	PROG_CROSSBAR		= 2,	/* any number of different textures per instruction */
+	PROG_ALPHA			= 4		/* alpha program, constants are read by their alpha */
+};
+
+/* kinds of instruction source operands */
+enum {
+	SRC_PREV,	/* result of another instruction */
+	SRC_COL,	/* primary color */
+	SRC_CONST,	/* immediate constant */
+	SRC_TEX		/* texture */
+};
+
+/* a single instruction of the compiled program. The meaning of arg
+ * depends on the source kind: instruction index for SRC_PREV, constant
+ * index for SRC_CONST, texture slot for SRC_TEX (up to 65535). Sources
+ * an operator doesn't use are copies of the first one. The result is
+ * multiplied by scale (1, 2 or 4) before it saturates.
+ */
+#define MAX_SOURCES	3
+
+struct instr {
+	unsigned char op;
+	unsigned char src[MAX_SOURCES];
+	unsigned short arg[MAX_SOURCES];
+	unsigned char scale;
+};
+
+/* compiled expression, a flat array of instructions in postfix order
+ * (every instruction comes after the ones it takes results from), plus
+ * a table of the constants they refer to.
+ */
+struct program {
+	struct instr *code;
+	int count;
+
+	float (*consts)[4];
+	int const_count;
+
+	int tex_count;		/* number of texture slots (highest slot + 1) */
+	unsigned int flags;	/* PROG_* optional instructions that may be used */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* lowers an expression tree to a program, flags is a combination of
+ * PROG_* bits for the optional instructions the target supports.
+ */
+struct program *mtexp_compile(const struct ptree *tree, unsigned int flags);
+
+/* frees a compiled program */
+void mtexp_free_program(struct program *prog);
+
+/* returns non-zero if the program is a single chain, where each
+ * instruction uses at most the result of the one right before it.
+ */
+int mtexp_is_chain(const struct program *prog);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _PROGRAM_H_ */
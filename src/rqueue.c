@@ -0,0 +1,124 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <stdlib.h>
+#include "mtexp.h"
+#include "state.h"
+
+struct item {
+	const struct mtexp *state;
+	mtexp_draw_func draw;
+	void *cls;
+	int seq;	/* submission order, keeps the sort stable */
+};
+
+struct mtexp_queue {
+	struct item *items;
+	int count, size;
+};
+
+static int item_cmp(const void *a, const void *b);
+
+struct mtexp_queue *mtexp_queue_create(void) {
+	struct mtexp_queue *q;
+
+	if(!(q = malloc(sizeof *q))) return 0;
+	q->items = 0;
+	q->count = q->size = 0;
+	return q;
+}
+
+void mtexp_queue_free(struct mtexp_queue *q) {
+	if(q) {
+		free(q->items);
+		free(q);
+	}
+}
+
+int mtexp_queue_add(struct mtexp_queue *q, const struct mtexp *state, mtexp_draw_func draw, void *cls) {
+	struct item *it;
+
+	if(q->count >= q->size) {
+		int new_size = q->size ? q->size * 2 : 64;
+		struct item *tmp;
+
+		if(!(tmp = realloc(q->items, new_size * sizeof *tmp))) {
+			return -1;
+		}
+		q->items = tmp;
+		q->size = new_size;
+	}
+
+	it = q->items + q->count;
+	it->state = state;
+	it->draw = draw;
+	it->cls = cls;
+	it->seq = q->count++;
+	return 0;
+}
+
+void mtexp_queue_flush(struct mtexp_queue *q) {
+	int i, j, end, pass;
+	const struct mtexp *cur = 0;
+
+	qsort(q->items, q->count, sizeof *q->items, item_cmp);
+
+	for(i=0; i<q->count; i++) {
+		struct item *it = q->items + i;
+
+		if(it->state != cur) {
+			mtexp_switch(cur, it->state);
+			cur = it->state;
+		}
+
+		if(cur->passes > 1) {
+			/* all the draws of a multipass state, one pass at a time */
+			for(end=i+1; end<q->count && q->items[end].state == cur; end++);
+
+			for(pass=0; pass<cur->passes; pass++) {
+				if(pass) mtexp_enable_pass(cur, pass);
+				for(j=i; j<end; j++) {
+					q->items[j].draw(q->items[j].cls);
+				}
+			}
+			mtexp_disable(cur);
+			cur = 0;
+			i = end - 1;
+			continue;
+		}
+		it->draw(it->cls);
+	}
+	mtexp_switch(cur, 0);
+
+	q->count = 0;
+}
+
+static int item_cmp(const void *a, const void *b) {
+	const struct item *ia = a;
+	const struct item *ib = b;
+	int res;
+
+	if(ia->state != ib->state && (res = mtexp_state_cmp(ia->state, ib->state))) {
+		return res;
+	}
+	return ia->seq - ib->seq;
+}
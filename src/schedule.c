@@ -0,0 +1,349 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <stdlib.h>
+#include "schedule.h"
+#include "optimize.h"
+
+#define IS_OP(t)		((t)->symb.type == SYMB_TYPE_OP)
+#define IS_SHARED(t)	(IS_OP(t) && (t)->left == (t)->right)
+#define IS_ASSOC(op)	((op) == SYMB_PLUS || (op) == SYMB_MUL)
+
+/* rewrites tried on every operator, each is undone by its opposite */
+enum {
+	MOVE_SWAP,		/* a op b -> b op a */
+	MOVE_ROT_RIGHT,	/* (a op b) op c -> a op (b op c) */
+	MOVE_ROT_LEFT,	/* a op (b op c) -> (a op b) op c */
+	MOVE_EXCHANGE,	/* (a op b) op c -> (a op c) op b */
+	NUM_MOVES
+};
+static const int undo_move[] = {MOVE_SWAP, MOVE_ROT_LEFT, MOVE_ROT_RIGHT, MOVE_EXCHANGE};
+
+/* upper limit of improvements, each of them lowers the cost */
+#define MAX_ITER	256
+
+/* rewrites are combined up to this many at a time, to get past
+ * orders which don't fit in between two that do.
+ */
+#define MAX_DEPTH	2
+
+struct search {
+	struct ptree *tree;
+	unsigned int flags;
+	int max_units;
+
+	struct program *best;
+	struct sched_cost best_cost;
+	int nomem;
+};
+
+static int improve(struct search *s, int depth);
+static int try_current(struct search *s);
+static int first_read(const struct program *prog, int i, int j);
+static int apply_move(struct ptree *t, int move);
+static int regroup_ok(const struct ptree *t, const struct ptree *child);
+static void collect(struct ptree *t, struct ptree **node, int *count);
+static void lower_bound(const struct ptree *t, unsigned int flags, struct sched_cost *cost);
+static void collect_leaves(const struct ptree *t, const struct ptree **leaf, int *count);
+static int absorbed(const struct ptree *t, unsigned int flags);
+static int cost_cmp(const struct sched_cost *a, const struct sched_cost *b);
+
+/* --- mtexp_schedule() ---
+ * The units form a chain, so a schedule is the order in which the tree is
+ * evaluated, along with the way its operators are grouped. Starting from
+ * the tree as it is, the rewrites allowed by commutativity and
+ * associativity are tried, one at a time and then in pairs, and each
+ * resulting program is costed. The first one cheaper than the best so far
+ * is kept, until no rewrite helps anymore.
+ */
+struct program *mtexp_schedule(struct ptree *tree, unsigned int flags, int max_units, struct sched_cost *cost) {
+	struct search s;
+	struct sched_cost min;
+	int depth, iter = 0;
+
+	s.tree = tree;
+	s.flags = flags;
+	s.max_units = max_units;
+	s.nomem = 0;
+
+	if(!(s.best = mtexp_compile(tree, flags))) return 0;
+	mtexp_program_cost(s.best, max_units, &s.best_cost);
+
+	/* the last round of a search, the one finding nothing better, tries
+	 * every pair of rewrites. Skip it if nothing better can exist.
+	 */
+	lower_bound(tree, flags, &min);
+	if(s.best_cost.fits && s.best_cost.units <= min.units &&
+			s.best_cost.colors <= min.colors && s.best_cost.fetches <= min.fetches) {
+		iter = MAX_ITER;
+	}
+
+	while(iter++ < MAX_ITER) {
+		for(depth=1; depth<=MAX_DEPTH; depth++) {
+			if(improve(&s, depth)) break;
+		}
+		if(depth > MAX_DEPTH || s.nomem) break;
+	}
+
+	if(cost) *cost = s.best_cost;
+	return s.best;
+}
+
+/* tries every rewrite on every operator, followed by depth - 1 more */
+static int improve(struct search *s, int depth) {
+	struct ptree *node[STACK_SIZE];
+	int i, m, count = 0;
+
+	collect(s->tree, node, &count);
+
+	for(i=0; i<count; i++) {
+		for(m=0; m<NUM_MOVES; m++) {
+			if(!apply_move(node[i], m)) continue;
+
+			if(depth > 1 ? improve(s, depth - 1) : try_current(s)) {
+				return 1;
+			}
+			apply_move(node[i], undo_move[m]);
+
+			if(s->nomem) return 0;
+		}
+	}
+	return 0;
+}
+
+/* costs the tree as it is now, and keeps it if it's the best so far */
+static int try_current(struct search *s) {
+	struct program *prog;
+	struct sched_cost c;
+
+	if(!(prog = mtexp_compile(s->tree, s->flags))) {
+		s->nomem = 1;	/* settle for what we have */
+		return 0;
+	}
+	mtexp_program_cost(prog, s->max_units, &c);
+
+	if(cost_cmp(&c, &s->best_cost) < 0) {
+		mtexp_free_program(s->best);
+		s->best = prog;
+		s->best_cost = c;
+		return 1;
+	}
+	mtexp_free_program(prog);
+	return 0;
+}
+
+/* --- mtexp_program_cost() ---
+ * With the crossbar, every texture is bound to a unit of its own, so
+ * there are at least as many units as textures.
+ */
+void mtexp_program_cost(const struct program *prog, int max_units, struct sched_cost *cost) {
+	int i, j, k, slots = 0;
+
+	cost->units = prog->count;
+	cost->colors = cost->fetches = 0;
+
+	for(i=0; i<prog->count; i++) {
+		const struct instr *in = prog->code + i;
+		int color = 0;
+
+		for(j=0; j<MAX_SOURCES; j++) {
+			if(in->src[j] == SRC_CONST) color = 1;
+			if(in->src[j] != SRC_TEX) continue;
+
+			if(first_read(prog, i, j)) slots++;
+
+			/* the same texture twice is read once */
+			for(k=0; k<j; k++) {
+				if(in->src[k] == SRC_TEX && in->arg[k] == in->arg[j]) break;
+			}
+			if(k == j) cost->fetches++;
+		}
+		cost->colors += color;
+	}
+
+	if((prog->flags & PROG_CROSSBAR) && slots > cost->units) {
+		cost->units = slots;
+	}
+
+	cost->fits = mtexp_is_chain(prog) && cost->units <= max_units;
+}
+
+/* non-zero if texture source j of instruction i is the first one of the
+ * program to read its slot.
+ */
+static int first_read(const struct program *prog, int i, int j) {
+	int k, slot = prog->code[i].arg[j];
+
+	for(; i>=0; i--) {
+		const struct instr *in = prog->code + i;
+
+		for(k=j-1; k>=0; k--) {
+			if(in->src[k] == SRC_TEX && in->arg[k] == slot) return 0;
+		}
+		j = MAX_SOURCES;
+	}
+	return 1;
+}
+
+static int apply_move(struct ptree *t, int move) {
+	struct ptree *tmp, *child;
+	int op = t->symb.symb;
+
+	if(!IS_OP(t) || IS_SHARED(t)) return 0;
+
+	switch(move) {
+	case MOVE_SWAP:
+		if(op == SYMB_MINUS) return 0;
+		tmp = t->left;
+		t->left = t->right;
+		t->right = tmp;
+		break;
+
+	case MOVE_ROT_RIGHT:
+		child = t->left;
+		if(!regroup_ok(t, child)) return 0;
+		tmp = child->left;
+		child->left = child->right;
+		child->right = t->right;
+		t->left = tmp;
+		t->right = child;
+		break;
+
+	case MOVE_ROT_LEFT:
+		child = t->right;
+		if(!regroup_ok(t, child)) return 0;
+		tmp = child->right;
+		child->right = child->left;
+		child->left = t->left;
+		t->left = child;
+		t->right = tmp;
+		break;
+
+	case MOVE_EXCHANGE:
+		child = t->left;
+		if(!regroup_ok(t, child)) return 0;
+		tmp = child->right;
+		child->right = t->right;
+		t->right = tmp;
+		break;
+
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+/* operands can be regrouped across an operator and its child, if both
+ * are the same associative operator, and none of the operands is a scale
+ * factor, which applies only to the operand it's grouped with.
+ */
+static int regroup_ok(const struct ptree *t, const struct ptree *child) {
+	const struct ptree *other = child == t->left ? t->right : t->left;
+
+	if(!IS_ASSOC(t->symb.symb) || !IS_OP(child) || IS_SHARED(child)) return 0;
+	if(child->symb.symb != t->symb.symb) return 0;
+
+	return !mtexp_scale_factor(other) && !mtexp_scale_factor(child->left) &&
+		!mtexp_scale_factor(child->right);
+}
+
+/* all operators of the tree, shared subtrees only once */
+static void collect(struct ptree *t, struct ptree **node, int *count) {
+	if(!IS_OP(t)) return;
+
+	node[(*count)++] = t;
+	collect(t->left, node, count);
+	if(!IS_SHARED(t)) {
+		collect(t->right, node, count);
+	}
+}
+
+/* --- lower_bound() ---
+ * cost no order of the tree can go below. Every texture takes a unit of
+ * its own, and each unit after the first spends one of its three sources
+ * on the previous result, so the values read by the tree take at least
+ * 1 + (n - 2) / 2 units. Constants are only certain to need a constant
+ * color when a combiner function can't stand for them (0.5, 0, 1 or a
+ * scale factor).
+ */
+static void lower_bound(const struct ptree *t, unsigned int flags, struct sched_cost *cost) {
+	const struct ptree *leaf[2 * STACK_SIZE];
+	int i, j, count = 0, values = 0, consts = 0;
+
+	collect_leaves(t, leaf, &count);
+
+	cost->fits = 1;
+	cost->colors = cost->fetches = 0;
+
+	for(i=0; i<count; i++) {
+		if(leaf[i]->symb.symb == SYMB_NUM) {
+			if(!absorbed(leaf[i], flags)) consts = 1;
+			continue;
+		}
+		for(j=0; j<i; j++) {
+			if(leaf[j]->symb.symb == leaf[i]->symb.symb) break;
+		}
+		if(j < i) continue;
+
+		values++;
+		if(leaf[i]->symb.symb != SYMB_COL) cost->fetches++;
+	}
+	values += consts;
+	cost->colors = consts;
+
+	cost->units = values > 3 ? 1 + (values - 2) / 2 : 1;
+	if(cost->fetches > cost->units) {
+		cost->units = cost->fetches;
+	}
+}
+
+/* all operands of the tree, shared subtrees only once */
+static void collect_leaves(const struct ptree *t, const struct ptree **leaf, int *count) {
+	if(!IS_OP(t)) {
+		if(*count < 2 * STACK_SIZE) leaf[(*count)++] = t;
+		return;
+	}
+	collect_leaves(t->left, leaf, count);
+	if(!IS_SHARED(t)) {
+		collect_leaves(t->right, leaf, count);
+	}
+}
+
+/* non-zero if a constant may end up part of a combiner function */
+static int absorbed(const struct ptree *t, unsigned int flags) {
+	const float *v = t->symb.val.value;
+	int i;
+
+	if(mtexp_scale_factor(t)) return 1;
+
+	for(i=(flags & PROG_ALPHA) ? 3 : 0; i<((flags & PROG_ALPHA) ? 4 : 3); i++) {
+		if(v[i] != 0.0f && v[i] != 0.5f && v[i] != 1.0f) return 0;
+	}
+	return 1;
+}
+
+static int cost_cmp(const struct sched_cost *a, const struct sched_cost *b) {
+	if(a->fits != b->fits) return a->fits ? -1 : 1;
+	if(a->units != b->units) return a->units - b->units;
+	if(a->colors != b->colors) return a->colors - b->colors;
+	return a->fetches - b->fetches;
+}
@@ -0,0 +1,55 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+
+#include "parser.h"
+#include "program.h"
+
+/* cost of a schedule, compared in the order of the fields */
+struct sched_cost {
+	int fits;		/* a single chain, within the available units */
+	int units;		/* texture units, including the ones holding textures */
+	int colors;		/* units using their constant color */
+	int fetches;	/* texture reads, over all units */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* picks the evaluation order of the tree that needs the fewest texture
+ * units, and returns the program for it. The tree is left in that order.
+ * max_units is the number of units available, and flags the PROG_* bits
+ * passed on to mtexp_compile. If cost isn't null, the cost of the chosen
+ * program is returned through it.
+ */
+struct program *mtexp_schedule(struct ptree *tree, unsigned int flags, int max_units, struct sched_cost *cost);
+
+/* evaluates the cost of running a program */
+void mtexp_program_cost(const struct program *prog, int max_units, struct sched_cost *cost);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _SCHEDULE_H_ */
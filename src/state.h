@@ -0,0 +1,144 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <stdarg.h>
+#include "mtexp.h"
+#include "parser.h"
+#include "glstate.h"
+
+/* precompiled state of a single texture unit. Textures are referred to
+ * by slot (the N of tN), the actual texture objects belong to each state.
+ */
+struct unit {
+	int tex;			/* texture slot bound to the unit, -1 for none */
+	GLenum mode;		/* GL_COMBINE, or GL_COMBINE4_NV */
+	GLenum op;			/* combine function */
+	GLenum src[3];		/* combiner sources */
+	int src_count;		/* sources used by the combine function (2 or 3) */
+	int scale;			/* GL_RGB_SCALE */
+
+	/* alpha combiner, GL_COMBINE units only */
+	GLenum alpha_op;
+	GLenum alpha_src[3];
+	int alpha_src_count;
+	int alpha_scale;	/* GL_ALPHA_SCALE */
+
+	float color[4];		/* constant (environment) color */
+	int has_color;		/* COLOR_* parts of the color in use */
+
+	unsigned int sig;	/* hash of the combiner setup, for sorting */
+};
+
+/* parts of the constant color a unit reads */
+enum {
+	COLOR_RGB	= 1,
+	COLOR_ALPHA	= 2
+};
+
+/* compiled expression, immutable once created, and shared by all the
+ * states created from the same expression through a cache.
+ */
+struct compiled {
+	struct unit *unit;	/* allocated right after the struct */
+	int unit_count;
+	int tex_count;		/* number of texture slots, one argument each */
+	int has_alpha;		/* compiled with an alpha expression */
+	unsigned int caps;	/* GLS_* features it was compiled for */
+	int max_units;		/* and the number of units that were available */
+
+	/* expressions split in several passes have a unit table for each,
+	 * linked from the first one, which also holds the texture slots of
+	 * all of them.
+	 */
+	int blend;			/* PASS_* blending with the passes before it */
+	int pass_count;
+	struct compiled *next_pass;
+
+	/* render to texture temporaries, in the slots from temp_base on */
+	int temp;			/* temporary the pass renders, -1 for none */
+	int temp_base;		/* INT_MAX if there are no temporaries */
+
+	/* the GLSL program is linked on the GL thread, when a state first
+	 * enables it, so that compiling makes no OpenGL calls.
+	 */
+	char *expr;			/* the expression, first pass only */
+	struct glsl_code *glsl;	/* shader of the whole expression, first pass only, 0 for none */
+	unsigned int shader;	/* program linked from it, 0 if not linked yet or failed */
+	int shader_linked;	/* linking was attempted */
+};
+
+struct bake;
+struct glsl_code;
+
+struct mtexp {
+	const struct compiled *comp;
+	int own_comp;		/* comp belongs to this state alone (not cached) */
+	int passes;			/* rendering passes of the expression */
+	int shader;			/* runs comp->glsl in a single pass instead of the units */
+	unsigned int *tex;	/* temporaries (after tex_count) are left 0 */
+	GLenum *target;		/* texture targets, 0 if not known yet */
+	int tex_count;
+	int slot_count;		/* room in tex and target, for a baked slot and the temporaries */
+	int active_tree;
+
+	/* sort key, the textures of all units followed by the
+	 * combiner signature of each unit (2 * unit_count). It's allocated
+	 * along with the state, and followed by tex and target.
+	 */
+	unsigned int *key;
+	unsigned int *key_buf;	/* allocated on its own when a compilation needs more units, or 0 */
+	int key_units;			/* units the unbaked sort key has room for */
+
+	struct bake *bake;	/* static part of the expression, baked to a texture */
+
+	int first_call;	/* for debugging purposes */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* orders states so that similar ones end up next to each other */
+int mtexp_state_cmp(const struct mtexp *a, const struct mtexp *b);
+
+/* features of the OpenGL implementation as detected by mtexp_init or
+ * mtexp_set_gl, 0 until then. Makes no OpenGL calls.
+ */
+unsigned int mtexp_get_caps(void);
+
+/* compiles an expression, returns null on error */
+struct compiled *mtexp_compile_expr(const char *expr);
+void mtexp_free_compiled(struct compiled *comp);
+
+/* creates a state from a compiled expression, reading the texture
+ * arguments from the argument list. If own is non-zero, the compiled
+ * expression is freed along with the state.
+ */
+struct mtexp *mtexp_create_state(const struct compiled *comp, int own, va_list ap);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _STATE_H_ */
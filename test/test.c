@@ -0,0 +1,240 @@
+/*
+This file is part of libmtexp, a library providing an intuitive interface
+to OpenGL multitexturing.
+
+Copyright (C) 2005 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* runs expressions on the mock OpenGL backend, and compares the units
+ * they're scheduled to, the calls enabling them, and the GLSL generated
+ * for them against the expected output in expect/, one file per test.
+ * With -u the files are written instead, to update the expectations
+ * after an intended change (review the difference before committing).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "mtexp.h"
+
+#define GL_TEXTURE_2D	0x0de1
+
+#define OUT_SIZE	16384
+
+struct sched_test {
+	const char *name;
+	const char *expr;
+	const char *ext;	/* GL_EXTENSIONS of the mock */
+};
+
+struct glsl_test {
+	const char *name;
+	const char *expr;
+};
+
+static int run_sched(const struct sched_test *t);
+static int run_glsl(const struct glsl_test *t);
+static void print_sched(const struct mtexp *state);
+static void print_log(void);
+static int check(const char *name);
+static void out(const char *fmt, ...);
+
+/* texture objects of t0, t1 and t2 */
+#define TEX0	10
+#define TEX1	11
+#define TEX2	12
+
+/* the output is the schedule, followed by the calls of mtexp_enable */
+static struct sched_test sched_tests[] = {
+	{"fused", "t0 + t1 - <0.5 0.5 0.5>", ""},
+	{"combine3", "t0 * c + <0.3 0.2 0.1>", "GL_ATI_texture_env_combine3"},
+	{"combine4", "t0 * c + <0.3 0.2 0.1>", "GL_NV_texture_env_combine4"},
+	{0, 0, 0}
+};
+
+static struct glsl_test glsl_tests[] = {
+	{"glsl_fused", "t0 + t1 - <0.5 0.5 0.5>"},
+	{"glsl_interpolate", "t0 * c + t1 * (<1 1 1> - c)"},
+	{"glsl_alpha", "t0 * t1 * <0.2 0.4 0.6> ; t1 * <1 1 1 0.5>"},
+	{0, 0}
+};
+
+static int update;
+static char out_buf[OUT_SIZE], expect_buf[OUT_SIZE];
+static int out_len;
+
+int main(int argc, char **argv) {
+	int i, j, failed = 0;
+
+	update = argc > 1 && strcmp(argv[1], "-u") == 0;
+
+	mtexp_mock_texture(TEX0, GL_TEXTURE_2D);
+	mtexp_mock_texture(TEX1, GL_TEXTURE_2D);
+	mtexp_mock_texture(TEX2, GL_TEXTURE_2D);
+	mtexp_texture_target(TEX0, GL_TEXTURE_2D);
+	mtexp_texture_target(TEX1, GL_TEXTURE_2D);
+	mtexp_texture_target(TEX2, GL_TEXTURE_2D);
+
+	for(i=0; sched_tests[i].name; i++) {
+		failed += run_sched(sched_tests + i);
+	}
+	for(j=0; glsl_tests[j].name; j++) {
+		failed += run_glsl(glsl_tests + j);
+	}
+
+	printf("%d of %d tests failed\n", failed, i + j);
+	return failed ? EXIT_FAILURE : 0;
+}
+
+static int run_sched(const struct sched_test *t) {
+	struct mtexp *state;
+
+	mtexp_mock_extensions(t->ext);
+	mtexp_mock_version("1.3 mock");
+	mtexp_mock_max_units(4);
+	mtexp_set_gl(mtexp_mock_gl());
+
+	out_len = 0;
+	if(!(state = mtexp_create(t->expr, TEX0, TEX1, TEX2))) {
+		out("mtexp_create failed\n");
+		return check(t->name);
+	}
+	print_sched(state);
+
+	mtexp_mock_reset(0);
+	mtexp_enable(state);
+	print_log();
+
+	mtexp_disable(state);
+	mtexp_free(state);
+	return check(t->name);
+}
+
+static int run_glsl(const struct glsl_test *t) {
+	char *src;
+
+	mtexp_mock_extensions("");
+	mtexp_mock_version("2.0 mock");
+	mtexp_set_gl(mtexp_mock_gl());
+
+	out_len = 0;
+	if(!(src = mtexp_glsl_source(t->expr))) {
+		out("mtexp_glsl_source failed\n");
+	} else {
+		out("%s", src);
+		free(src);
+	}
+	return check(t->name);
+}
+
+static void print_sched(const struct mtexp *state) {
+	struct mtexp_unit_info info[8];
+	int i, j, count;
+
+	count = mtexp_get_schedule(state, info, 8);
+
+	for(i=0; i<count && i<8; i++) {
+		const struct mtexp_unit_info *u = info + i;
+
+		out("unit %d: slot %d mode %x rgb %x(", i, u->slot, u->mode, u->combine);
+		for(j=0; j<u->src_count; j++) {
+			out(j ? " %x" : "%x", u->src[j]);
+		}
+		out(")*%d alpha %x(", u->scale, u->alpha_combine);
+		for(j=0; j<u->alpha_src_count; j++) {
+			out(j ? " %x" : "%x", u->alpha_src[j]);
+		}
+		out(")*%d", u->alpha_scale);
+		if(u->has_color) {
+			out(" color %g %g %g %g", u->color[0], u->color[1], u->color[2], u->color[3]);
+		}
+		out("\n");
+	}
+}
+
+static void print_log(void) {
+	const struct mtexp_mock_call *log;
+	int i, count;
+
+	log = mtexp_mock_log(&count);
+
+	for(i=0; i<count; i++) {
+		const struct mtexp_mock_call *c = log + i;
+
+		out("%s %x %x", mtexp_mock_func_name(c->func), c->arg[0], c->arg[1]);
+		if(c->func == MTEXP_GL_TEX_ENVI) {
+			out(" %x", (unsigned int)c->val.i);
+		} else if(c->func == MTEXP_GL_TEX_ENVFV) {
+			out(" %g %g %g %g", c->val.f[0], c->val.f[1], c->val.f[2], c->val.f[3]);
+		}
+		out("\n");
+	}
+}
+
+/* compares the output of a test with the expected one, and reports the
+ * first line that differs. Returns 1 if the test failed.
+ */
+static int check(const char *name) {
+	char path[256];
+	const char *a = out_buf, *b = expect_buf;
+	FILE *fp;
+	size_t len;
+	int line = 1;
+
+	sprintf(path, "expect/%s", name);
+
+	if(update) {
+		if(!(fp = fopen(path, "w")) || fwrite(out_buf, 1, out_len, fp) != (size_t)out_len) {
+			fprintf(stderr, "%s: failed to write %s\n", name, path);
+			if(fp) fclose(fp);
+			return 1;
+		}
+		fclose(fp);
+		printf("%s: updated\n", name);
+		return 0;
+	}
+
+	if(!(fp = fopen(path, "r"))) {
+		fprintf(stderr, "%s: failed to open %s\n", name, path);
+		return 1;
+	}
+	len = fread(expect_buf, 1, OUT_SIZE - 1, fp);
+	expect_buf[len] = 0;
+	fclose(fp);
+
+	while(*a && *a == *b) {
+		if(*a++ == '\n') line++;
+		b++;
+	}
+	if(!*a && !*b) {
+		printf("%s: ok\n", name);
+		return 0;
+	}
+
+	printf("%s: FAILED at line %d\n", name, line);
+	printf("--- expected:\n%s--- got:\n%s", expect_buf, out_buf);
+	return 1;
+}
+
+static void out(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	out_len += vsprintf(out_buf + out_len, fmt, ap);
+	va_end(ap);
+}